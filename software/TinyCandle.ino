@@ -40,7 +40,7 @@
 //
 // Leave the rest on default settings. Don't forget to "Burn bootloader"!
 // No Arduino core functions or libraries are used. Use the makefile if 
-// you want to compile without Arduino IDE.
+// you want to compile without Arduino IDE. Feature toggles are in config.h.
 //
 // Fuse settings: -U lfuse:w:0x2a:m -U hfuse:w:0xff:m
 
@@ -54,6 +54,7 @@
 #include <avr/sleep.h>            // for sleep modes
 #include <avr/interrupt.h>        // for interrupts
 #include <util/delay.h>           // for delays
+#include "config.h"               // feature toggles
 
 // Pin definitions
 #define LED0          PB0         // pin connected to LED 1/2
@@ -69,12 +70,27 @@
 // Pseudo Random Number Generator (adapted from Łukasz Podkalicki)
 // ===================================================================================
 
-// Start state (any nonzero value will work)
-uint16_t rn = 0xACE1;
+// Start state (LFSRSEED and LFSRTAPS in config.h)
+uint16_t rn = LFSRSEED;
 
 // Pseudo random number generator
 uint16_t prng(uint16_t maxvalue) {
-  rn = (rn >> 0x01) ^ (-(rn & 0x01) & 0xB400);
+#if LFSRTAPS & 0xFF
+  rn = (rn >> 0x01) ^ (-(rn & 0x01) & LFSRTAPS);
+#else
+  uint8_t tmp;
+  // rn = (rn >> 0x01) ^ (-(rn & 0x01) & LFSRTAPS), found by tools/superopt (5 instead of 12 words)
+  asm (
+    "lsr  %B0            \n\t"
+    "ror  %A0            \n\t"
+    "ldi  %1, %2         \n\t"
+    "brcc 1f             \n\t"
+    "eor  %B0, %1        \n\t"
+    "1:                  \n\t"
+    : "+r" (rn), "=&d" (tmp)
+    : "M" (LFSRTAPS >> 8)
+  );
+#endif
   return(rn % maxvalue);
 }
 
@@ -87,16 +103,36 @@ uint16_t prng(uint16_t maxvalue) {
 #define MAXUNCALM     (60 * 256)
 #define UNCALMINC     10
 #define MAXDEV        100
-#define CANDLEDELAY   15
+
+// Filter coefficients (flamedesign: a1 = 1.750000, a2 = 0.882812)
+#define IIR_A1(y)     ((y) + (y) - ((y) >> 2))
+#define IIR_A2(y)     ((y) + ((y) >> 7) - ((y) >> 3))
+#define IIR_SHIFT     2
+#define IIR_LIMIT     (MAXDEV << IIR_SHIFT)
 
 // Some variables
+#if ENGINE == 1
+int16_t centerx = 0;              // filter output y[n-1]
+int16_t centery = 0;
+int16_t prevx = 0;                // filter output y[n-2]
+int16_t prevy = 0;
+#else
 int16_t centerx = MAXDEV;
 int16_t centery = MAXDEV / 2;
 int16_t xvel = 0;
 int16_t yvel = 0;
+uint8_t cnt = 0;
+#endif
 uint16_t uncalm =   MINUNCALM;
 int16_t uncalmdir = UNCALMINC;
-uint8_t cnt = 0;
+
+// PWM outputs (with several flames those of the flame being updated)
+#if FLAMES > 1
+uint8_t pwma, pwmb;
+#define SETLEDS(a, b) { pwma = (a); pwmb = (b); }
+#else
+#define SETLEDS(a, b) { OCR0A = (a); OCR0B = (b); }
+#endif
 
 // Candle simulation
 void updateCandle() {
@@ -119,6 +155,24 @@ void updateCandle() {
   if(uncalm > MAXUNCALM) uncalmdir = -UNCALMINC;
   uncalm += uncalmdir;
 
+#if ENGINE == 1
+  // Filter the random pokes: y[n] = x[n] + a1 * y[n-1] - a2 * y[n-2]
+  movx += IIR_A1(centerx) - IIR_A2(prevx);
+  movy += IIR_A1(centery) - IIR_A2(prevy);
+  prevx = centerx;
+  prevy = centery;
+
+  // Range limits
+  if(movx < -IIR_LIMIT) movx = -IIR_LIMIT;
+  if(movx >  IIR_LIMIT) movx =  IIR_LIMIT;
+  if(movy < -IIR_LIMIT) movy = -IIR_LIMIT;
+  if(movy >  IIR_LIMIT) movy =  IIR_LIMIT;
+  centerx = movx;
+  centery = movy;
+
+  // Set LEDs
+  SETLEDS(128 + (centerx >> IIR_SHIFT), 128 + (centery >> IIR_SHIFT));
+#else
   // Move center of flame by the current velocity
   centerx += movx + (xvel >> 2);
   centery += movy + (yvel >> 2); 
@@ -143,10 +197,74 @@ void updateCandle() {
   yvel -= centery;
 
   // Set LEDs
-  OCR0A = 128 + centerx;
-  OCR0B = 128 + centery;
+  SETLEDS(128 + centerx, 128 + centery);
+#endif
+}
+
+#if FLAMES > 1
+// ===================================================================================
+// Multiple Flames (FLAMES and SUBFRAMES in config.h)
+// ===================================================================================
+
+// Packed state of a flame, the variables of updateCandle() are the working copy of the
+// flame being updated. All flames share the random number generator. The direction of
+// uncalm is bit 15 of uncalm (uncalm stays below 0x8000).
+typedef struct {
+#if ENGINE == 1
+  int16_t  centerx, centery;
+  int16_t  prevx, prevy;
+#else
+  int8_t   centerx, centery;      // -MAXDEV..MAXDEV
+  int16_t  xvel, yvel;
+  uint8_t  cnt;
+#endif
+  uint16_t uncalm;
+} flame_t;
+
+flame_t flames[FLAMES];
+
+// Copy working state into flame
+void storeFlame(flame_t *f) {
+  f->centerx = centerx;
+  f->centery = centery;
+#if ENGINE == 1
+  f->prevx   = prevx;
+  f->prevy   = prevy;
+#else
+  f->xvel    = xvel;
+  f->yvel    = yvel;
+  f->cnt     = cnt;
+#endif
+  f->uncalm  = uncalm | (uncalmdir < 0 ? 0x8000 : 0);
 }
 
+// Update flame i and set its PWM outputs
+void updateFlame(uint8_t i) {
+  flame_t *f = &flames[i];
+  centerx   = f->centerx;
+  centery   = f->centery;
+#if ENGINE == 1
+  prevx     = f->prevx;
+  prevy     = f->prevy;
+#else
+  xvel      = f->xvel;
+  yvel      = f->yvel;
+  cnt       = f->cnt;
+#endif
+  uncalm    = f->uncalm & 0x7FFF;
+  uncalmdir = (f->uncalm & 0x8000) ? -UNCALMINC : UNCALMINC;
+  updateCandle();
+  storeFlame(f);
+
+  // The ATtiny13A has only OC0A/OC0B, which show the first flame. On targets with more
+  // PWM channels, set the compare registers of the other flames here.
+  if(i == 0) {
+    OCR0A = pwma;
+    OCR0B = pwmb;
+  }
+}
+#endif
+
 // ===================================================================================
 // Main Function
 // ===================================================================================
@@ -154,9 +272,20 @@ void updateCandle() {
 // Main function
 int main(void) {
   // PWM setup
+#if PWMMODE == 1
+  TCCR0A = (1<<COM0A1) | (1<<COM0B1)    // clear OC0A/OC0B on compare match when up-counting
+         | (1<<WGM00);                  // phase correct PWM 0x00 - 0xff
+#else
   TCCR0A = (1<<COM0A1) | (1<<COM0B1)    // clear OC0A/OC0B on compare match, set at TOP
          | (1<<WGM01)  | (1<<WGM00);    // fast PWM 0x00 - 0xff
+#endif
+#if PWMPRESC == 64
+  TCCR0B = (1<<CS01) | (1<<CS00);       // start timer with prescaler 64
+#elif PWMPRESC == 8
+  TCCR0B = (1<<CS01);                   // start timer with prescaler 8
+#else
   TCCR0B = (1<<CS00);                   // start timer without prescaler
+#endif
 
   // Setup pins
   DDRB   = (1<<LED0) | (1<<LED1)        // LED pins as output
@@ -175,9 +304,22 @@ int main(void) {
   PRR    = (1<<PRADC);                  // shut down ADC
   set_sleep_mode (SLEEP_MODE_PWR_DOWN); // set sleep mode to power down
 
+#if FLAMES > 1
+  // All flames start like the first one
+  uint8_t i, sub = 0;
+  for(i = 0; i < FLAMES; i++) storeFlame(&flames[i]);
+#endif
+
   // Main loop
   while(1) {
+#if FLAMES > 1
+    // Candle simulation of every SUBFRAMES-th flame, so each flame is updated once per
+    // frame and every sub-frame has the same load
+    for(i = sub; i < FLAMES; i += SUBFRAMES) updateFlame(i);
+    if(++sub == SUBFRAMES) sub = 0;
+#else
     updateCandle();                     // candle simulation
+#endif
     if(~PINB & (1<<BUTTON)) {           // if button is pressed
       DDRB  &= ~((1<<LED0) | (1<<LED1));// LED pins as input (PWM off)
       PORTB &= ~(1<<MOSFET);            // switch off MOSFET
@@ -190,7 +332,11 @@ int main(void) {
       _delay_ms(10);                    // debounce button
       while(~PINB & (1<<BUTTON));       // wait for button released
     }  
+#if FLAMES > 1
+  _delay_ms((double)CANDLEDELAY / SUBFRAMES); // delay of one sub-frame
+#else
   _delay_ms(CANDLEDELAY);               // delay
+#endif
   }
 }
 
@@ -0,0 +1,66 @@
+// ===================================================================================
+// Project:   TinyCandle - Configuration
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Feature toggles and tuning settings of the firmware in one place. Every setting can
+// also be overridden on the compiler command line (e.g. -DENGINE=1), which is how
+// "make matrix" builds every combination of the toggles to compare flash, SRAM,
+// cycles per frame and current. The host tools include this file as well, so their
+// model of the firmware follows the configuration.
+//
+// Budget of the ATtiny13A: 1024 bytes flash, 64 bytes SRAM (variables and stack).
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// Flame engine (0: spring/velocity integrator, 1: shift-only IIR filtered noise)
+#ifndef ENGINE
+#define ENGINE        0
+#endif
+
+// Frame delay in ms
+#ifndef CANDLEDELAY
+#define CANDLEDELAY   15
+#endif
+
+// PWM mode (0: fast PWM, 1: phase correct PWM)
+#ifndef PWMMODE
+#define PWMMODE       0
+#endif
+
+// PWM prescaler (1, 8 or 64)
+#ifndef PWMPRESC
+#define PWMPRESC      1
+#endif
+
+// Number of independent flames and sub-frames per frame. The flames are updated in
+// turn, FLAMES / SUBFRAMES of them in every sub-frame of CANDLEDELAY / SUBFRAMES ms,
+// so every flame is updated once per frame and the load of the sub-frames is flat
+// (a single flame is updated once per frame of CANDLEDELAY ms, SUBFRAMES is ignored).
+// More than one flame needs a target with two PWM channels per flame, see
+// updateFlame() in TinyCandle.ino ("make budget" shows how many flames fit).
+#ifndef FLAMES
+#define FLAMES        1
+#endif
+#ifndef SUBFRAMES
+#define SUBFRAMES     1
+#endif
+
+// LFSR start state (any nonzero value will work) and taps of a maximal-length LFSR,
+// taps with zero low byte use the short assembler step (tools/seedplan assigns seeds
+// and taps to the units of a fleet)
+#ifndef LFSRSEED
+#define LFSRSEED      0xACE1
+#endif
+#ifndef LFSRTAPS
+#define LFSRTAPS      0xB400
+#endif
+
+#endif
@@ -0,0 +1,416 @@
+// ===================================================================================
+// Project:   TinyCandle - Disassembly Diff with Cycle Deltas
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Compares two disassemblies of the firmware (tinycandle.asm from "make asm", i.e.
+// avr-objdump -d) function by function (main, updateCandle and prng unless inlined,
+// the libgcc helpers such as __udivmodhi4, the vectors). The instructions of each
+// function are aligned by their longest common subsequence, with branch targets
+// inside the function compared by their basic block and calls and jumps to other
+// functions by symbol, so inserted or removed code does not misalign the rest. The diff is split into basic blocks (at branch targets and after branches,
+// jumps, returns and skips) and every block is annotated with its static byte and
+// cycle delta (branches and skips counted as not taken). With execution profiles of
+// both builds (tinysim -P), the measured cycles of every instruction are summed per
+// block and divided by the number of frames, which shows the real per-frame impact of
+// a change. The cycles of interrupt dispatch and wake-up, which belong to no
+// instruction, are compared separately. By default only blocks with changes are
+// printed.
+//
+// Usage:
+// ------
+// asmdiff [options] old.asm new.asm
+//   -p FILE    execution profile of the old build (tinysim -P)
+//   -q FILE    execution profile of the new build
+//   -f NAME    compare only function NAME (repeatable)
+//   -a         print all blocks, not only the changed ones
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Diff settings
+#define MAXINSNS      1024        // instructions of a disassembly (1 KB flash)
+#define MAXFUNCS      64
+#define MAXSELECT     16
+#define FLASHWORDS    512
+
+// Instruction of the disassembly
+typedef struct {
+  unsigned addr;                  // byte address
+  int      size;                  // bytes
+  int      cycles;                // static cycles (not taken)
+  int      flow;                  // ends a basic block (branch, jump, return, skip)
+  int      skip;                  // skips the next instruction
+  int      target;                // branch target byte address, -1 if none
+  int      leader;                // starts a basic block
+  char     text[80];              // mnemonic and operands
+  char     key[80];               // text with branch targets by block or symbol
+} insn_t;
+
+// Function (label of the disassembly)
+typedef struct {
+  char name[48];
+  int  first, n;                  // instructions
+} func_t;
+
+// Disassembly with execution profile
+typedef struct {
+  insn_t   insn[MAXINSNS];
+  int      ninsn;
+  func_t   func[MAXFUNCS];
+  int      nfunc;
+  uint64_t count[FLASHWORDS];     // executions per word address
+  uint64_t cycles[FLASHWORDS];    // cycles per word address
+  uint64_t frames;                // 0 if no profile
+  uint64_t dcycles;               // cycles of interrupt dispatch and wake-up
+} asm_t;
+
+// Edit script of a function pair
+typedef struct {
+  char op;                        // '=', '-' or '+'
+  int  a, b;                      // instruction indices in old and new, -1 if none
+} edit_t;
+
+static asm_t olda, newa;
+
+// ===================================================================================
+// Parsing
+// ===================================================================================
+
+// Mnemonic in list
+static int oneof(const char *mn, const char *const *list) {
+  for(; *list; list++) if(!strcmp(mn, *list)) return 1;
+  return 0;
+}
+
+// Static cycles of the AVR core of the ATtiny13A, branches and skips not taken
+static void timing(insn_t *in, const char *mn) {
+  static const char *const two[]   = {"adiw", "sbiw", "ld", "ldd", "st", "std", "lds", "sts",
+                                      "push", "pop", "rjmp", "ijmp", "cbi", "sbi", NULL};
+  static const char *const three[] = {"lpm", "rcall", "icall", "jmp", NULL};
+  static const char *const four[]  = {"ret", "reti", "call", NULL};
+  static const char *const jumps[] = {"rjmp", "ijmp", "jmp", "ret", "reti", NULL};
+  static const char *const skips[] = {"cpse", "sbrc", "sbrs", "sbic", "sbis", NULL};
+
+  in->cycles = oneof(mn, four) ? 4 : oneof(mn, three) ? 3 : oneof(mn, two) ? 2 : 1;
+  in->skip   = oneof(mn, skips);
+  in->flow   = oneof(mn, jumps) || in->skip || (mn[0] == 'b' && mn[1] == 'r' && strcmp(mn, "break"));
+}
+
+// Parse "  4a:	80 91 60 00 	lds	r24, 0x0060	; 0x800060 <rn>"
+static int parse_insn(const char *line, insn_t *in) {
+  char        bytes[40], mn[16], ops[64] = "", sym[48] = "";
+  const char *p, *c;
+  unsigned    addr, off = 0;
+  int         n = 0, len;
+
+  if(sscanf(line, " %x:%n", &addr, &len) != 1 || line[len] != '\t') return 0;
+  p = line + len + 1;
+  if(sscanf(p, "%39[0-9a-f ]", bytes) != 1) return 0;
+  for(c = bytes; *c; c++) if(*c != ' ' && (c == bytes || c[-1] == ' ')) n++;
+  p += strlen(bytes);
+  while(*p == '\t' || *p == ' ') p++;
+  if(sscanf(p, "%15s", mn) != 1 || mn[0] == '.') return 0;
+  p += strlen(mn);
+  while(*p == '\t' || *p == ' ') p++;
+  c = strchr(p, ';');
+  len = c ? c - p : (int)strcspn(p, "\n");
+  snprintf(ops, sizeof(ops), "%.*s", len, p);
+  while(len && (ops[len - 1] == ' ' || ops[len - 1] == '\t')) ops[--len] = 0;
+
+  memset(in, 0, sizeof(*in));
+  in->addr   = addr;
+  in->size   = n;
+  in->target = -1;
+  timing(in, mn);
+  snprintf(in->text, sizeof(in->text), "%-6s %s", mn, ops);
+  memcpy(in->key, in->text, sizeof(in->key));
+
+  // Branch or call target: address and symbol of the comment (the key of a target
+  // inside the function is replaced by its basic block in readasm)
+  if(c && (ops[0] == '.' || !strcmp(mn, "jmp") || !strcmp(mn, "call") || mn[0] == 'b')) {
+    unsigned t;
+    if(sscanf(c, "; 0x%x <%47[^>+]+0x%x", &t, sym, &off) >= 1) {
+      in->target = t;
+      if(off) snprintf(in->key, sizeof(in->key), "%-6s <%s+0x%x>", mn, sym, off);
+      else    snprintf(in->key, sizeof(in->key), "%-6s <%s>", mn, sym);
+    }
+  }
+  return 1;
+}
+
+// Read disassembly, returns 0 on success
+static int readasm(asm_t *a, const char *filename) {
+  FILE *f = fopen(filename, "r");
+  char  line[256], name[48];
+  unsigned addr;
+  int   i, j;
+
+  if(!f) return -1;
+  while(fgets(line, sizeof(line), f)) {
+    if(sscanf(line, "%x <%47[^>]>:", &addr, name) == 2) {
+      if(a->nfunc == MAXFUNCS) break;
+      snprintf(a->func[a->nfunc].name, sizeof(a->func[0].name), "%s", name);
+      a->func[a->nfunc].first = a->ninsn;
+      a->nfunc++;
+    } else if(a->nfunc && a->ninsn < MAXINSNS && parse_insn(line, &a->insn[a->ninsn])) {
+      a->func[a->nfunc - 1].n++;
+      a->ninsn++;
+    }
+  }
+  fclose(f);
+
+  // Basic block leaders: function start, branch targets, after branches and skips
+  for(i = 0; i < a->nfunc; i++) {
+    func_t *fn = &a->func[i];
+    if(!fn->n) continue;
+    a->insn[fn->first].leader = 1;
+    for(j = fn->first; j < fn->first + fn->n; j++) {
+      insn_t *in = &a->insn[j];
+      int     k;
+      if(in->flow && j + 1 < fn->first + fn->n) a->insn[j + 1].leader = 1;
+      if(in->skip && j + 2 < fn->first + fn->n) a->insn[j + 2].leader = 1;
+      if(in->target < 0) continue;
+      for(k = fn->first; k < fn->first + fn->n; k++)
+        if(a->insn[k].addr == (unsigned)in->target) a->insn[k].leader = 1;
+    }
+  }
+
+  // Targets inside the function by basic block index, which survives shifted code
+  for(i = 0; i < a->nfunc; i++) {
+    func_t *fn = &a->func[i];
+    if(!fn->n) continue;
+    for(j = fn->first; j < fn->first + fn->n; j++) {
+      insn_t  *in = &a->insn[j];
+      unsigned t  = (unsigned)in->target;
+      char     mn[16];
+      int      k, block = -1;
+      if(in->target < 0 || t < a->insn[fn->first].addr || t > a->insn[fn->first + fn->n - 1].addr)
+        continue;
+      for(k = fn->first; k < fn->first + fn->n && a->insn[k].addr <= t; k++) block += a->insn[k].leader;
+      sscanf(in->text, "%15s", mn);
+      snprintf(in->key, sizeof(in->key), "%-6s .B%d", mn, block);
+    }
+  }
+  return a->ninsn ? 0 : -1;
+}
+
+// Read tinysim profile, returns 0 on success
+static int readprofile(asm_t *a, const char *filename) {
+  FILE *f = fopen(filename, "r");
+  char  line[128];
+  unsigned long long frames, count, cycles;
+  unsigned addr;
+
+  if(!f) return -1;
+  while(fgets(line, sizeof(line), f)) {
+    if(sscanf(line, "frames %llu", &frames) == 1) a->frames = frames;
+    else if(sscanf(line, "dispatch %llu %llu", &count, &cycles) == 2) a->dcycles = cycles;
+    else if(sscanf(line, "0x%x %llu %llu", &addr, &count, &cycles) == 3 && addr / 2 < FLASHWORDS) {
+      a->count[addr / 2]  = count;
+      a->cycles[addr / 2] = cycles;
+    }
+  }
+  fclose(f);
+  return a->frames ? 0 : -1;
+}
+
+// ===================================================================================
+// Diff
+// ===================================================================================
+
+// Function by name, NULL if none
+static const func_t *function(const asm_t *a, const char *name) {
+  int i;
+  for(i = 0; i < a->nfunc; i++) if(!strcmp(a->func[i].name, name)) return &a->func[i];
+  return NULL;
+}
+
+// Align two instruction sequences by their longest common subsequence
+static int align(const func_t *fa, const func_t *fb, edit_t *e) {
+  int  n = fa ? fa->n : 0, m = fb ? fb->n : 0, i, j, k = 0;
+  int *l = calloc((size_t)(n + 1) * (m + 1), sizeof(int));
+  #define L(i, j)       l[(i) * (m + 1) + (j)]
+  #define KEYA(i)       olda.insn[fa->first + (i)].key
+  #define KEYB(j)       newa.insn[fb->first + (j)].key
+
+  for(i = n - 1; i >= 0; i--)
+    for(j = m - 1; j >= 0; j--)
+      L(i, j) = !strcmp(KEYA(i), KEYB(j)) ? L(i + 1, j + 1) + 1
+              : (L(i + 1, j) >= L(i, j + 1) ? L(i + 1, j) : L(i, j + 1));
+  for(i = 0, j = 0; i < n || j < m; ) {
+    if(i < n && j < m && !strcmp(KEYA(i), KEYB(j))) {
+      e[k++] = (edit_t){'=', fa->first + i++, fb->first + j++};
+    } else if(i < n && (j == m || L(i + 1, j) >= L(i, j + 1))) {
+      e[k++] = (edit_t){'-', fa->first + i++, -1};
+    } else e[k++] = (edit_t){'+', -1, fb->first + j++};
+  }
+  free(l);
+  return k;
+}
+
+// Cycles per frame of an instruction from the profile, 0 if none
+static double perframe(const asm_t *a, const insn_t *in) {
+  return a->frames ? (double)a->cycles[in->addr / 2] / a->frames : 0;
+}
+
+// Totals of a block or function
+typedef struct {
+  int    bytes[2], cycles[2];
+  double frame[2];
+  int    changed;
+} sum_t;
+
+static void add(sum_t *s, const edit_t *e) {
+  if(e->a >= 0) {
+    s->bytes[0]  += olda.insn[e->a].size;
+    s->cycles[0] += olda.insn[e->a].cycles;
+    s->frame[0]  += perframe(&olda, &olda.insn[e->a]);
+  }
+  if(e->b >= 0) {
+    s->bytes[1]  += newa.insn[e->b].size;
+    s->cycles[1] += newa.insn[e->b].cycles;
+    s->frame[1]  += perframe(&newa, &newa.insn[e->b]);
+  }
+  s->changed |= e->op != '=';
+}
+
+// Print block header and its instructions
+static void block(const edit_t *e, int n, int profiled) {
+  sum_t s;
+  int   i;
+
+  memset(&s, 0, sizeof(s));
+  for(i = 0; i < n; i++) add(&s, &e[i]);
+  printf("  block %s0x%04x -> %s0x%04x: %+d bytes, %+d cycles",
+         e[0].a >= 0 ? "" : "~", e[0].a >= 0 ? olda.insn[e[0].a].addr : 0,
+         e[0].b >= 0 ? "" : "~", e[0].b >= 0 ? newa.insn[e[0].b].addr : 0,
+         s.bytes[1] - s.bytes[0], s.cycles[1] - s.cycles[0]);
+  if(profiled) {
+    const insn_t *first = e[0].b >= 0 ? &newa.insn[e[0].b] : &olda.insn[e[0].a];
+    const asm_t  *a     = e[0].b >= 0 ? &newa : &olda;
+    printf(", %.2fx per frame, %+.1f cycles/frame", (double)a->count[first->addr / 2] / a->frames,
+           s.frame[1] - s.frame[0]);
+  }
+  printf("\n");
+  for(i = 0; i < n; i++) {
+    const insn_t *in = e[i].op == '+' ? &newa.insn[e[i].b] : &olda.insn[e[i].a];
+    const asm_t  *a  = e[i].op == '+' ? &newa : &olda;
+    printf("  %c %04x  %-36s %d", e[i].op == '=' ? ' ' : e[i].op, in->addr, in->text, in->cycles);
+    if(profiled) printf("  %10.1f", perframe(a, in));
+    printf("\n");
+  }
+}
+
+// Diff of a function pair, returns totals
+static sum_t diff(const char *name, int all, int profiled) {
+  const func_t *fa = function(&olda, name), *fb = function(&newa, name);
+  edit_t       *e  = malloc(2 * MAXINSNS * sizeof(edit_t));
+  sum_t         s;
+  int           n  = align(fa, fb, e), i, start;
+
+  memset(&s, 0, sizeof(s));
+  for(i = 0; i < n; i++) add(&s, &e[i]);
+  if(!s.changed && !all) {
+    free(e);
+    return s;
+  }
+  printf("%s%s: %d -> %d bytes (%+d), %d -> %d cycles static (%+d)", name,
+         !fa ? " (new)" : !fb ? " (removed)" : "", s.bytes[0], s.bytes[1], s.bytes[1] - s.bytes[0],
+         s.cycles[0], s.cycles[1], s.cycles[1] - s.cycles[0]);
+  if(profiled) printf(", %.1f -> %.1f cycles/frame (%+.1f)", s.frame[0], s.frame[1], s.frame[1] - s.frame[0]);
+  printf("\n");
+
+  // Blocks start at a leader of either build
+  for(start = 0, i = 1; i <= n; i++) {
+    sum_t b;
+    int   j;
+    if(i < n && !(e[i].a >= 0 && olda.insn[e[i].a].leader) && !(e[i].b >= 0 && newa.insn[e[i].b].leader))
+      continue;
+    memset(&b, 0, sizeof(b));
+    for(j = start; j < i; j++) add(&b, &e[j]);
+    if(b.changed || all) block(&e[start], i - start, profiled);
+    start = i;
+  }
+  printf("\n");
+  free(e);
+  return s;
+}
+
+// ===================================================================================
+// Main
+// ===================================================================================
+
+// Print usage
+static void usage(void) {
+  fprintf(stderr,
+    "Usage: asmdiff [options] old.asm new.asm\n"
+    "  -p FILE    execution profile of the old build (tinysim -P)\n"
+    "  -q FILE    execution profile of the new build\n"
+    "  -f NAME    compare only function NAME (repeatable)\n"
+    "  -a         print all blocks, not only the changed ones\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *select[MAXSELECT], *profa = NULL, *profb = NULL;
+  int         nselect = 0, all = 0, profiled, opt, i;
+  sum_t       total, s;
+
+  while((opt = getopt(argc, argv, "p:q:f:ah")) != -1) {
+    switch(opt) {
+      case 'p': profa = optarg; break;
+      case 'q': profb = optarg; break;
+      case 'f': if(nselect < MAXSELECT) select[nselect++] = optarg; break;
+      case 'a': all = 1; break;
+      default:  usage();
+    }
+  }
+  if(optind != argc - 2) usage();
+  if(readasm(&olda, argv[optind]) || readasm(&newa, argv[optind + 1])) {
+    fprintf(stderr, "Error: cannot read disassembly %s\n", olda.ninsn ? argv[optind + 1] : argv[optind]);
+    return 1;
+  }
+  if((profa && readprofile(&olda, profa)) || (profb && readprofile(&newa, profb))) {
+    fprintf(stderr, "Error: cannot read profile\n");
+    return 1;
+  }
+  profiled = olda.frames && newa.frames;
+  if((profa || profb) && !profiled) fprintf(stderr, "Warning: profiles of both builds needed, ignored\n");
+
+  // Functions of both builds in the order of the old one, then the new ones
+  memset(&total, 0, sizeof(total));
+  for(i = 0; i < olda.nfunc + newa.nfunc; i++) {
+    const char *name = i < olda.nfunc ? olda.func[i].name : newa.func[i - olda.nfunc].name;
+    int         k;
+    if(i >= olda.nfunc && function(&olda, name)) continue;
+    for(k = 0; k < nselect && strcmp(select[k], name); k++);
+    if(nselect && k == nselect) continue;
+    s = diff(name, all, profiled);
+    total.bytes[0]  += s.bytes[0];
+    total.bytes[1]  += s.bytes[1];
+    total.cycles[0] += s.cycles[0];
+    total.cycles[1] += s.cycles[1];
+    total.frame[0]  += s.frame[0];
+    total.frame[1]  += s.frame[1];
+  }
+  printf("Total: %d -> %d bytes (%+d), %d -> %d cycles static (%+d)", total.bytes[0], total.bytes[1],
+         total.bytes[1] - total.bytes[0], total.cycles[0], total.cycles[1], total.cycles[1] - total.cycles[0]);
+  if(profiled) printf(", %.1f -> %.1f cycles/frame (%+.1f)", total.frame[0], total.frame[1],
+                      total.frame[1] - total.frame[0]);
+  printf("\n");
+  if(profiled) {
+    double d0 = (double)olda.dcycles / olda.frames, d1 = (double)newa.dcycles / newa.frames;
+    printf("Interrupt dispatch and wake-up: %.1f -> %.1f cycles/frame (%+.1f)\n", d0, d1, d1 - d0);
+  }
+  return 0;
+}
@@ -0,0 +1,832 @@
+// ===================================================================================
+// Project:   TinyCandle - Instruction Level Simulator for ATtiny13A
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Instruction timing follows the AVRe core of the ATtiny13A (no MUL, no JMP/CALL,
+// 8-bit stack pointer). Timer0 compare matches are evaluated on the counter value of
+// the previous timer clock, which gives the (OCR0x + 1) / 256 duty cycle of the fast
+// PWM mode used by the firmware.
+
+#include <stdio.h>
+#include <string.h>
+#include "avrsim.h"
+
+// Shortcuts
+#define R(x)          (m->data[(x)])
+#define SREG          R(AVR_SREG)
+#define FLAG(b)       ((SREG >> (b)) & 1)
+#define SETFLAG(b,v)  (SREG = (SREG & ~(1 << (b))) | ((!!(v)) << (b)))
+
+// Timer0 prescaler values (0 = stopped or external clock)
+static const uint16_t prescaler[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+// Interrupt vectors
+#define VECT_INT0     1
+#define VECT_PCINT0   2
+#define VECT_TIM0OVF  3
+#define VECT_COMPA    6
+#define VECT_COMPB    7
+#define VECT_WDT      8
+
+// Start-up time from power-down with internal oscillator (SUT fuses 0x2a)
+#define STARTUPCK     6
+
+// ===================================================================================
+// Pins
+// ===================================================================================
+
+// Recalculate pin levels and detect pin changes
+static void updatepins(avr_t *m) {
+  uint8_t ddr  = R(AVR_DDRB);
+  uint8_t port = R(AVR_PORTB);
+  uint8_t out  = port;
+  uint8_t in;
+
+  // Timer0 compare outputs override the port register
+  if(R(AVR_TCCR0A) & 0xC0) out = (out & ~0x01) | m->oc0a;
+  if(R(AVR_TCCR0A) & 0x30) out = (out & ~0x02) | (m->oc0b << 1);
+
+  // Inputs: pull-ups unless disabled, external drivers take precedence
+  in = (R(AVR_MCUCR) & 0x40) ? 0 : port;
+  in = (in & ~m->extdrive) | (m->extlevel & m->extdrive);
+  m->pins = ((out & ddr) | (in & ~ddr)) & 0x3F;
+
+  // Pin change interrupt flag
+  if((m->pins ^ m->pcprev) & R(AVR_PCMSK)) R(AVR_GIFR) |= (1 << AVR_PCIF);
+
+  // INT0 on PB1 (edge modes only, low level is evaluated on dispatch)
+  if((m->pins ^ m->pcprev) & 0x02) {
+    uint8_t isc  = R(AVR_MCUCR) & 0x03;
+    uint8_t high = (m->pins >> 1) & 1;
+    if(isc == 1 || (isc == 2 && !high) || (isc == 3 && high))
+      R(AVR_GIFR) |= (1 << AVR_INTF0);
+  }
+  m->pcprev = m->pins;
+}
+
+// Set external level of a pin
+void avr_setpin(avr_t *m, uint8_t pin, uint8_t drive, uint8_t level) {
+  if(drive) m->extdrive |=  (1 << pin);
+  else      m->extdrive &= ~(1 << pin);
+  if(level) m->extlevel |=  (1 << pin);
+  else      m->extlevel &= ~(1 << pin);
+  updatepins(m);
+}
+
+// ===================================================================================
+// Timer0 and Watchdog
+// ===================================================================================
+
+// Compare output action: 0 = none, 1 = toggle, 2 = clear, 3 = set
+static uint8_t compare(uint8_t out, uint8_t action) {
+  switch(action) {
+    case 1:  return out ^ 1;
+    case 2:  return 0;
+    case 3:  return 1;
+    default: return out;
+  }
+}
+
+// One timer clock
+static void timer_clock(avr_t *m) {
+  uint8_t wgm  = (R(AVR_TCCR0A) & 0x03) | ((R(AVR_TCCR0B) >> 1) & 0x04);
+  uint8_t coma = R(AVR_TCCR0A) >> 6;
+  uint8_t comb = (R(AVR_TCCR0A) >> 4) & 0x03;
+  uint8_t old  = R(AVR_TCNT0);
+  uint8_t t    = old;
+  uint8_t top  = (wgm == 2 || (wgm & 0x04)) ? m->ocra : 0xFF;
+  uint8_t acta, actb;
+
+  if(wgm == 1 || wgm == 5) {
+    // Phase correct PWM: count up to TOP, then down to BOTTOM
+    if(!m->down) {
+      if(t < top) t++;
+      if(t == top) {
+        m->down = 1;
+        m->ocra = R(AVR_OCR0A);
+        m->ocrb = R(AVR_OCR0B);
+      }
+    } else {
+      if(t) t--;
+      if(!t) {
+        m->down = 0;
+        R(AVR_TIFR0) |= (1 << AVR_TOV0);
+      }
+    }
+    R(AVR_TCNT0) = t;
+    acta = (coma == 1) ? ((wgm & 0x04) ? 1 : 0) : (coma ? (coma ^ m->down) : 0);
+    actb = (comb == 1) ? 0 : (comb ? (comb ^ m->down) : 0);
+    if(t == m->ocra) {
+      R(AVR_TIFR0) |= (1 << AVR_OCF0A);
+      m->oc0a = compare(m->oc0a, acta);
+    }
+    if(t == m->ocrb) {
+      R(AVR_TIFR0) |= (1 << AVR_OCF0B);
+      m->oc0b = compare(m->oc0b, actb);
+    }
+  } else {
+    // Normal, CTC and fast PWM: compare match on previous counter value
+    uint8_t fast = (wgm == 3 || wgm == 7);
+    if(fast) {
+      acta = (coma == 1) ? ((wgm & 0x04) ? 1 : 0) : coma;
+      actb = (comb == 1) ? 0 : comb;
+    } else {
+      acta = coma;
+      actb = comb;
+    }
+    if(old == m->ocra) {
+      R(AVR_TIFR0) |= (1 << AVR_OCF0A);
+      if(!(fast && coma >= 2 && m->ocra == top)) m->oc0a = compare(m->oc0a, acta);
+    }
+    if(old == m->ocrb) {
+      R(AVR_TIFR0) |= (1 << AVR_OCF0B);
+      if(!(fast && comb >= 2 && m->ocrb == top)) m->oc0b = compare(m->oc0b, actb);
+    }
+    if(old == top) {
+      t = 0;
+      if(wgm != 2 || top == 0xFF) R(AVR_TIFR0) |= (1 << AVR_TOV0);
+      if(fast) {
+        // Update compare registers and set/clear outputs at BOTTOM
+        m->ocra = R(AVR_OCR0A);
+        m->ocrb = R(AVR_OCR0B);
+        if(coma >= 2) m->oc0a = (coma == 2);
+        if(comb >= 2) m->oc0b = (comb == 2);
+      }
+    } else t++;
+    R(AVR_TCNT0) = t;
+  }
+}
+
+// Watchdog timeout in clock cycles
+static uint32_t wdt_timeout(avr_t *m) {
+  uint8_t  wdtcr = R(AVR_WDTCR);
+  uint8_t  wdp   = (wdtcr & 0x07) | ((wdtcr >> 2) & 0x08);
+  if(wdp > 9) wdp = 9;
+  return (uint32_t)(((uint64_t)2048 << wdp) * m->freq / 128000);
+}
+
+// Advance peripherals by n clock cycles
+static void tick(avr_t *m, int n) {
+  while(n--) {
+    m->cycles++;
+
+    // Timer0 runs unless its clock is stopped (power-down) or shut down by PRR
+    if(m->sleep != AVR_PWRDOWN && !(R(AVR_PRR) & 0x02)) {
+      uint16_t div = prescaler[R(AVR_TCCR0B) & 0x07];
+      if(div && ++m->prescnt >= div) {
+        uint8_t a = m->oc0a, b = m->oc0b;
+        m->prescnt = 0;
+        timer_clock(m);
+        if(a != m->oc0a || b != m->oc0b) updatepins(m);
+      }
+    }
+
+    // Watchdog runs from its own oscillator in all sleep modes
+    if(R(AVR_WDTCR) & 0x48) {
+      if(++m->wdtcnt >= wdt_timeout(m)) {
+        m->wdtcnt = 0;
+        if(R(AVR_WDTCR) & 0x40) R(AVR_WDTCR) |= 0x80;
+        else {
+          avr_reset(m);
+          return;
+        }
+      }
+    }
+
+    if(m->cyclehook) m->cyclehook(m, m->hookctx);
+  }
+}
+
+// ===================================================================================
+// Data Space Access
+// ===================================================================================
+
+static uint8_t rd(avr_t *m, uint16_t addr) {
+  uint8_t v;
+  if(addr >= AVR_DATASIZE) {
+    m->fault = AVR_EADDRESS;
+    return 0;
+  }
+  v = (addr == AVR_PINB) ? m->pins : R(addr);
+  if(m->memhook) m->memhook(m, addr, v, 0, m->memctx);
+  return v;
+}
+
+static void wr(avr_t *m, uint16_t addr, uint8_t v) {
+  uint8_t wgm;
+  if(addr >= AVR_DATASIZE) {
+    m->fault = AVR_EADDRESS;
+    return;
+  }
+  if(m->memhook) m->memhook(m, addr, v, 1, m->memctx);
+  switch(addr) {
+    case AVR_TIFR0:
+    case AVR_GIFR:
+      R(addr) &= ~v;                            // write one to clear
+      return;
+    case AVR_WDTCR:
+      R(addr) = (R(addr) & ~(v & 0x80) & 0x80) | (v & 0x7F);
+      return;
+    case AVR_PINB:
+      R(AVR_PORTB) ^= v;                        // write one to toggle
+      updatepins(m);
+      return;
+    case AVR_OCR0A:
+    case AVR_OCR0B:
+      R(addr) = v;
+      wgm = (R(AVR_TCCR0A) & 0x03) | ((R(AVR_TCCR0B) >> 1) & 0x04);
+      if(wgm == 0 || wgm == 2) {                // no double buffering
+        if(addr == AVR_OCR0A) m->ocra = v;
+        else                  m->ocrb = v;
+      }
+      return;
+    case AVR_SPL:
+      R(addr) = v;
+      if(v < m->spmin) m->spmin = v;
+      return;
+    case AVR_DDRB:
+    case AVR_PORTB:
+    case AVR_TCCR0A:
+    case AVR_MCUCR:
+    case AVR_PCMSK:
+      R(addr) = v;
+      updatepins(m);
+      return;
+    default:
+      R(addr) = v;
+  }
+}
+
+// Stack operations
+static void push(avr_t *m, uint8_t v) {
+  uint8_t sp = R(AVR_SPL);
+  wr(m, sp, v);
+  R(AVR_SPL) = --sp;
+  if(sp < m->spmin) m->spmin = sp;
+}
+
+static uint8_t pop(avr_t *m) {
+  R(AVR_SPL)++;
+  return rd(m, R(AVR_SPL));
+}
+
+static void pushpc(avr_t *m, uint16_t pc) {
+  push(m, pc & 0xFF);
+  push(m, pc >> 8);
+}
+
+static uint16_t poppc(avr_t *m) {
+  uint16_t pc = (uint16_t)pop(m) << 8;
+  return pc | pop(m);
+}
+
+// ===================================================================================
+// Interrupts
+// ===================================================================================
+
+// Get highest priority pending interrupt vector (0 = none)
+static uint8_t pending(avr_t *m) {
+  uint8_t gimsk = R(AVR_GIMSK);
+  uint8_t tifr  = R(AVR_TIFR0) & R(AVR_TIMSK0);
+  if(m->forced) return m->forced;
+  if(gimsk & 0x40) {
+    if(R(AVR_GIFR) & (1 << AVR_INTF0)) return VECT_INT0;
+    if(!(R(AVR_MCUCR) & 0x03) && !(m->pins & 0x02)) return VECT_INT0;
+  }
+  if((gimsk & 0x20) && (R(AVR_GIFR) & (1 << AVR_PCIF))) return VECT_PCINT0;
+  if(tifr & (1 << AVR_TOV0))  return VECT_TIM0OVF;
+  if(tifr & (1 << AVR_OCF0A)) return VECT_COMPA;
+  if(tifr & (1 << AVR_OCF0B)) return VECT_COMPB;
+  if((R(AVR_WDTCR) & 0xC0) == 0xC0) return VECT_WDT;
+  return 0;
+}
+
+// Jump to interrupt vector, returns cycles used
+static int dispatch(avr_t *m, uint8_t vect) {
+  if(vect == m->forced) m->forced = 0;
+  else switch(vect) {
+    case VECT_INT0:    R(AVR_GIFR)  &= ~(1 << AVR_INTF0); break;
+    case VECT_PCINT0:  R(AVR_GIFR)  &= ~(1 << AVR_PCIF);  break;
+    case VECT_TIM0OVF: R(AVR_TIFR0) &= ~(1 << AVR_TOV0);  break;
+    case VECT_COMPA:   R(AVR_TIFR0) &= ~(1 << AVR_OCF0A); break;
+    case VECT_COMPB:   R(AVR_TIFR0) &= ~(1 << AVR_OCF0B); break;
+    case VECT_WDT:
+      R(AVR_WDTCR) &= ~0x80;
+      if(R(AVR_WDTCR) & 0x08) R(AVR_WDTCR) &= ~0x40;  // interrupt and reset mode
+      break;
+  }
+  pushpc(m, m->pc);
+  SETFLAG(AVR_SREG_I, 0);
+  m->pc = vect;
+  m->isr++;
+  tick(m, 4);
+  return 4;
+}
+
+// Raise interrupt vector regardless of its flag and enable bits
+void avr_interrupt(avr_t *m, uint8_t vect) {
+  if(vect >= 1 && vect <= 9) m->forced = vect;
+}
+
+// ===================================================================================
+// Instruction Execution
+// ===================================================================================
+
+// Two-word instruction (LDS, STS, JMP, CALL)
+static int is32(uint16_t op) {
+  return ((op & 0xFC0F) == 0x9000) || ((op & 0xFE0C) == 0x940C);
+}
+
+// Flags for addition and subtraction
+static void flags_add(avr_t *m, uint8_t d, uint8_t r, uint8_t res) {
+  uint8_t c = (d & r) | (r & ~res) | (~res & d);
+  uint8_t v = (d & r & ~res) | (~d & ~r & res);
+  SETFLAG(AVR_SREG_H, c & 0x08);
+  SETFLAG(AVR_SREG_C, c & 0x80);
+  SETFLAG(AVR_SREG_V, v & 0x80);
+  SETFLAG(AVR_SREG_N, res & 0x80);
+  SETFLAG(AVR_SREG_Z, !res);
+  SETFLAG(AVR_SREG_S, FLAG(AVR_SREG_N) ^ FLAG(AVR_SREG_V));
+}
+
+static void flags_sub(avr_t *m, uint8_t d, uint8_t r, uint8_t res, int keepz) {
+  uint8_t c = (~d & r) | (r & res) | (res & ~d);
+  uint8_t v = (d & ~r & ~res) | (~d & r & res);
+  SETFLAG(AVR_SREG_H, c & 0x08);
+  SETFLAG(AVR_SREG_C, c & 0x80);
+  SETFLAG(AVR_SREG_V, v & 0x80);
+  SETFLAG(AVR_SREG_N, res & 0x80);
+  SETFLAG(AVR_SREG_Z, keepz ? (!res && FLAG(AVR_SREG_Z)) : !res);
+  SETFLAG(AVR_SREG_S, FLAG(AVR_SREG_N) ^ FLAG(AVR_SREG_V));
+}
+
+static void flags_logic(avr_t *m, uint8_t res) {
+  SETFLAG(AVR_SREG_V, 0);
+  SETFLAG(AVR_SREG_N, res & 0x80);
+  SETFLAG(AVR_SREG_Z, !res);
+  SETFLAG(AVR_SREG_S, res & 0x80);
+}
+
+static void flags_shift(avr_t *m, uint8_t res, uint8_t c) {
+  SETFLAG(AVR_SREG_C, c);
+  SETFLAG(AVR_SREG_N, res & 0x80);
+  SETFLAG(AVR_SREG_Z, !res);
+  SETFLAG(AVR_SREG_V, FLAG(AVR_SREG_N) ^ c);
+  SETFLAG(AVR_SREG_S, FLAG(AVR_SREG_N) ^ FLAG(AVR_SREG_V));
+}
+
+// Skip next instruction, returns additional cycles
+static int skip(avr_t *m) {
+  int words = is32(m->flash[m->pc & (AVR_FLASHWORDS - 1)]) ? 2 : 1;
+  m->pc += words;
+  return words;
+}
+
+// Pointer register access
+static uint16_t getptr(avr_t *m, uint8_t r) {
+  return R(r) | ((uint16_t)R(r + 1) << 8);
+}
+
+static void setptr(avr_t *m, uint8_t r, uint16_t v) {
+  R(r)     = v & 0xFF;
+  R(r + 1) = v >> 8;
+}
+
+// Execute one instruction, returns cycles used
+static int execute(avr_t *m) {
+  uint16_t op, k16, ptr;
+  uint8_t  d, r, res, k, b, io;
+  int      cyc = 1;
+
+  if(m->pc >= AVR_FLASHWORDS) {
+    m->fault   = AVR_EFLASH;
+    m->faultpc = m->pc;
+    return 0;
+  }
+  op = m->flash[m->pc++];
+  d  = (op >> 4) & 0x1F;
+  r  = (op & 0x0F) | ((op >> 5) & 0x10);
+
+  switch(op >> 12) {
+    case 0x0:
+      if(op == 0x0000) break;                                         // NOP
+      if((op & 0xFF00) == 0x0100) {                                   // MOVW
+        R(((op >> 4) & 0x0F) * 2)     = R((op & 0x0F) * 2);
+        R(((op >> 4) & 0x0F) * 2 + 1) = R((op & 0x0F) * 2 + 1);
+        break;
+      }
+      switch((op >> 10) & 0x03) {
+        case 1:                                                       // CPC
+          res = R(d) - R(r) - FLAG(AVR_SREG_C);
+          flags_sub(m, R(d), R(r), res, 1);
+          break;
+        case 2:                                                       // SBC
+          res = R(d) - R(r) - FLAG(AVR_SREG_C);
+          flags_sub(m, R(d), R(r), res, 1);
+          R(d) = res;
+          break;
+        case 3:                                                       // ADD
+          res = R(d) + R(r);
+          flags_add(m, R(d), R(r), res);
+          R(d) = res;
+          break;
+        default:
+          m->fault = AVR_EILLEGAL;                                    // MUL variants
+      }
+      break;
+
+    case 0x1:
+      switch((op >> 10) & 0x03) {
+        case 0:                                                       // CPSE
+          if(R(d) == R(r)) cyc += skip(m);
+          break;
+        case 1:                                                       // CP
+          res = R(d) - R(r);
+          flags_sub(m, R(d), R(r), res, 0);
+          break;
+        case 2:                                                       // SUB
+          res = R(d) - R(r);
+          flags_sub(m, R(d), R(r), res, 0);
+          R(d) = res;
+          break;
+        case 3:                                                       // ADC
+          res = R(d) + R(r) + FLAG(AVR_SREG_C);
+          flags_add(m, R(d), R(r), res);
+          R(d) = res;
+          break;
+      }
+      break;
+
+    case 0x2:
+      switch((op >> 10) & 0x03) {
+        case 0: res = R(d) & R(r); flags_logic(m, res); R(d) = res; break;  // AND
+        case 1: res = R(d) ^ R(r); flags_logic(m, res); R(d) = res; break;  // EOR
+        case 2: res = R(d) | R(r); flags_logic(m, res); R(d) = res; break;  // OR
+        case 3: R(d) = R(r); break;                                         // MOV
+      }
+      break;
+
+    case 0x3: case 0x4: case 0x5: case 0x6: case 0x7:
+      d = 16 + ((op >> 4) & 0x0F);
+      k = ((op >> 4) & 0xF0) | (op & 0x0F);
+      switch(op >> 12) {
+        case 0x3: res = R(d) - k; flags_sub(m, R(d), k, res, 0); break;          // CPI
+        case 0x4: res = R(d) - k - FLAG(AVR_SREG_C);                             // SBCI
+                  flags_sub(m, R(d), k, res, 1); R(d) = res; break;
+        case 0x5: res = R(d) - k; flags_sub(m, R(d), k, res, 0); R(d) = res; break; // SUBI
+        case 0x6: res = R(d) | k; flags_logic(m, res); R(d) = res; break;        // ORI
+        case 0x7: res = R(d) & k; flags_logic(m, res); R(d) = res; break;        // ANDI
+      }
+      break;
+
+    case 0x8: case 0xA:                                               // LDD/STD Y+q, Z+q
+      k   = (op & 0x07) | ((op >> 7) & 0x18) | ((op >> 8) & 0x20);
+      ptr = getptr(m, (op & 0x08) ? 28 : 30) + k;
+      if(op & 0x0200) wr(m, ptr, R(d));
+      else R(d) = rd(m, ptr);
+      cyc = 2;
+      break;
+
+    case 0x9:
+      if((op & 0xFC00) == 0x9000) {                                   // LD/ST/LPM/PUSH/POP
+        uint8_t store = (op >> 9) & 1;
+        switch(op & 0x0F) {
+          case 0x0:                                                   // LDS/STS
+            k16 = m->flash[m->pc++ & (AVR_FLASHWORDS - 1)];
+            if(store) wr(m, k16, R(d));
+            else R(d) = rd(m, k16);
+            cyc = 2;
+            break;
+          case 0x1: case 0x2: case 0x9: case 0xA: case 0xC: case 0xD: case 0xE:
+            b   = ((op & 0x0F) >= 0xC) ? 26 : ((op & 0x08) ? 28 : 30);
+            ptr = getptr(m, b);
+            if((op & 0x03) == 0x02) ptr--;                            // pre-decrement
+            if(store) wr(m, ptr, R(d));
+            else R(d) = rd(m, ptr);
+            if((op & 0x03) == 0x01) ptr++;                            // post-increment
+            if((op & 0x03) != 0x00) setptr(m, b, ptr);
+            cyc = 2;
+            break;
+          case 0x4: case 0x5:                                         // LPM Rd,Z(+)
+            if(store) { m->fault = AVR_EILLEGAL; break; }
+            ptr = getptr(m, 30);
+            R(d) = (m->flash[(ptr >> 1) & (AVR_FLASHWORDS - 1)] >> ((ptr & 1) * 8)) & 0xFF;
+            if(op & 0x01) setptr(m, 30, ptr + 1);
+            cyc = 3;
+            break;
+          case 0xF:                                                   // PUSH/POP
+            if(store) push(m, R(d));
+            else R(d) = pop(m);
+            cyc = 2;
+            break;
+          default:
+            m->fault = AVR_EILLEGAL;
+        }
+        break;
+      }
+      if((op & 0xFE00) == 0x9400) {                                   // one operand
+        switch(op & 0x0F) {
+          case 0x0:                                                   // COM
+            res = ~R(d);
+            flags_logic(m, res);
+            SETFLAG(AVR_SREG_C, 1);
+            R(d) = res;
+            break;
+          case 0x1:                                                   // NEG
+            res = -R(d);
+            flags_sub(m, 0, R(d), res, 0);
+            R(d) = res;
+            break;
+          case 0x2:                                                   // SWAP
+            R(d) = (R(d) << 4) | (R(d) >> 4);
+            break;
+          case 0x3:                                                   // INC
+            res = R(d) + 1;
+            SETFLAG(AVR_SREG_V, res == 0x80);
+            SETFLAG(AVR_SREG_N, res & 0x80);
+            SETFLAG(AVR_SREG_Z, !res);
+            SETFLAG(AVR_SREG_S, FLAG(AVR_SREG_N) ^ FLAG(AVR_SREG_V));
+            R(d) = res;
+            break;
+          case 0x5:                                                   // ASR
+            res = (R(d) & 0x80) | (R(d) >> 1);
+            flags_shift(m, res, R(d) & 1);
+            R(d) = res;
+            break;
+          case 0x6:                                                   // LSR
+            res = R(d) >> 1;
+            flags_shift(m, res, R(d) & 1);
+            R(d) = res;
+            break;
+          case 0x7:                                                   // ROR
+            res = (FLAG(AVR_SREG_C) << 7) | (R(d) >> 1);
+            flags_shift(m, res, R(d) & 1);
+            R(d) = res;
+            break;
+          case 0x8:
+            if(op & 0x0100) {
+              switch(op) {
+                case 0x9508:                                          // RET
+                  m->pc = poppc(m);
+                  cyc = 4;
+                  break;
+                case 0x9518:                                          // RETI
+                  m->pc = poppc(m);
+                  SETFLAG(AVR_SREG_I, 1);
+                  if(m->isr) m->isr--;
+                  m->intlock = 1;
+                  cyc = 4;
+                  break;
+                case 0x9588:                                          // SLEEP
+                  if(R(AVR_MCUCR) & 0x20) {
+                    static const uint8_t modes[4] = {AVR_IDLE, AVR_ADCNR, AVR_PWRDOWN, AVR_IDLE};
+                    m->sleep = modes[(R(AVR_MCUCR) >> 3) & 0x03];
+                  }
+                  break;
+                case 0x9598:                                          // BREAK (ignored)
+                  break;
+                case 0x95C8:                                          // LPM (r0)
+                  ptr = getptr(m, 30);
+                  R(0) = (m->flash[(ptr >> 1) & (AVR_FLASHWORDS - 1)] >> ((ptr & 1) * 8)) & 0xFF;
+                  cyc = 3;
+                  break;
+                case 0x95A8:                                          // WDR
+                  m->wdtcnt = 0;
+                  break;
+                case 0x95E8:                                          // SPM (ignored)
+                  break;
+                default:
+                  m->fault = AVR_EILLEGAL;
+              }
+            } else {                                                  // BSET/BCLR
+              b = (op >> 4) & 0x07;
+              SETFLAG(b, !(op & 0x80));
+              if(b == AVR_SREG_I && !(op & 0x80)) m->intlock = 1;
+            }
+            break;
+          case 0x9:                                                   // IJMP/ICALL
+            if(op == 0x9409) m->pc = getptr(m, 30);
+            else if(op == 0x9509) {
+              pushpc(m, m->pc);
+              m->pc = getptr(m, 30);
+              cyc++;
+            }
+            else m->fault = AVR_EILLEGAL;
+            cyc++;
+            break;
+          case 0xA:                                                   // DEC
+            res = R(d) - 1;
+            SETFLAG(AVR_SREG_V, res == 0x7F);
+            SETFLAG(AVR_SREG_N, res & 0x80);
+            SETFLAG(AVR_SREG_Z, !res);
+            SETFLAG(AVR_SREG_S, FLAG(AVR_SREG_N) ^ FLAG(AVR_SREG_V));
+            R(d) = res;
+            break;
+          default:
+            m->fault = AVR_EILLEGAL;                                  // JMP/CALL/DES
+        }
+        break;
+      }
+      if((op & 0xFE00) == 0x9600) {                                   // ADIW/SBIW
+        uint16_t v, rs;
+        d  = 24 + ((op >> 3) & 0x06);
+        k  = (op & 0x0F) | ((op >> 2) & 0x30);
+        v  = getptr(m, d);
+        rs = (op & 0x0100) ? v - k : v + k;
+        if(op & 0x0100) {
+          SETFLAG(AVR_SREG_V, (v & 0x8000) && !(rs & 0x8000));
+          SETFLAG(AVR_SREG_C, (rs & 0x8000) && !(v & 0x8000));
+        } else {
+          SETFLAG(AVR_SREG_V, !(v & 0x8000) && (rs & 0x8000));
+          SETFLAG(AVR_SREG_C, !(rs & 0x8000) && (v & 0x8000));
+        }
+        SETFLAG(AVR_SREG_N, rs & 0x8000);
+        SETFLAG(AVR_SREG_Z, !rs);
+        SETFLAG(AVR_SREG_S, FLAG(AVR_SREG_N) ^ FLAG(AVR_SREG_V));
+        setptr(m, d, rs);
+        cyc = 2;
+        break;
+      }
+      if((op & 0xFC00) == 0x9800) {                                   // CBI/SBIC/SBI/SBIS
+        io = 0x20 + ((op >> 3) & 0x1F);
+        b  = op & 0x07;
+        switch((op >> 8) & 0x03) {
+          case 0: wr(m, io, rd(m, io) & ~(1 << b)); cyc = 2; break;
+          case 1: if(!(rd(m, io) & (1 << b))) cyc += skip(m); break;
+          case 2: wr(m, io, (io == AVR_PINB) ? (1 << b) : (rd(m, io) | (1 << b))); cyc = 2; break;
+          case 3: if(rd(m, io) & (1 << b)) cyc += skip(m); break;
+        }
+        break;
+      }
+      m->fault = AVR_EILLEGAL;                                        // MUL
+      break;
+
+    case 0xB:                                                         // IN/OUT
+      io = 0x20 + ((op & 0x0F) | ((op >> 5) & 0x30));
+      if(op & 0x0800) wr(m, io, R(d));
+      else R(d) = rd(m, io);
+      break;
+
+    case 0xC:                                                         // RJMP
+    case 0xD:                                                         // RCALL
+      k16 = op & 0x0FFF;
+      if(op & 0x1000) {
+        pushpc(m, m->pc);
+        cyc++;
+      }
+      m->pc = (m->pc + ((k16 & 0x0800) ? (int16_t)(k16 | 0xF000) : k16)) & (AVR_FLASHWORDS - 1);
+      cyc++;
+      break;
+
+    case 0xE:                                                         // LDI
+      R(16 + ((op >> 4) & 0x0F)) = ((op >> 4) & 0xF0) | (op & 0x0F);
+      break;
+
+    case 0xF:
+      b = op & 0x07;
+      if(!(op & 0x0800)) {                                            // BRBS/BRBC
+        int8_t off = (int8_t)((op >> 2) & 0xFE) >> 1;
+        if(FLAG(b) == !(op & 0x0400)) {
+          m->pc = (m->pc + off) & (AVR_FLASHWORDS - 1);
+          cyc++;
+        }
+        break;
+      }
+      if(op & 0x0008) {
+        m->fault = AVR_EILLEGAL;
+        break;
+      }
+      switch((op >> 9) & 0x03) {
+        case 0: R(d) = (R(d) & ~(1 << b)) | (FLAG(AVR_SREG_T) << b); break; // BLD
+        case 1: SETFLAG(AVR_SREG_T, R(d) & (1 << b)); break;                // BST
+        case 2: if(!(R(d) & (1 << b))) cyc += skip(m); break;               // SBRC
+        case 3: if(R(d) & (1 << b)) cyc += skip(m); break;                  // SBRS
+      }
+      break;
+  }
+
+  if(m->fault) {
+    m->faultpc = (m->pc - 1) & (AVR_FLASHWORDS - 1);
+    return 0;
+  }
+  return cyc;
+}
+
+// ===================================================================================
+// Public Functions
+// ===================================================================================
+
+// Initialize simulator with erased flash
+void avr_init(avr_t *m, uint32_t freq) {
+  memset(m, 0, sizeof(*m));
+  memset(m->flash, 0xFF, sizeof(m->flash));
+  m->freq = freq;
+  avr_reset(m);
+}
+
+// Reset the MCU (flash and external pin drivers are kept)
+void avr_reset(avr_t *m) {
+  memset(m->data, 0, sizeof(m->data));
+  R(AVR_SPL) = AVR_RAMEND;
+  m->spmin   = AVR_RAMEND;
+  m->pc      = 0;
+  m->sleep   = AVR_AWAKE;
+  m->isr     = 0;
+  m->halt    = 0;
+  m->intlock = 0;
+  m->forced  = 0;
+  m->prescnt = 0;
+  m->ocra    = 0;
+  m->ocrb    = 0;
+  m->oc0a    = 0;
+  m->oc0b    = 0;
+  m->down    = 0;
+  m->wdtcnt  = 0;
+  m->pcprev  = 0;
+  updatepins(m);
+  R(AVR_GIFR) = 0;
+}
+
+// Load Intel hex file into flash, returns number of bytes or -1 on error
+int avr_loadhex(avr_t *m, const char *filename) {
+  char line[600];
+  int  total = 0;
+  FILE *f = fopen(filename, "r");
+  if(!f) return -1;
+  while(fgets(line, sizeof(line), f)) {
+    unsigned int len, addr, type, byte, i;
+    if(line[0] != ':') continue;
+    if(sscanf(line + 1, "%2x%4x%2x", &len, &addr, &type) != 3) break;
+    if(type == 1) break;
+    if(type != 0) continue;
+    for(i = 0; i < len; i++) {
+      if(sscanf(line + 9 + i * 2, "%2x", &byte) != 1) {
+        fclose(f);
+        return -1;
+      }
+      if(addr + i >= AVR_FLASHWORDS * 2) continue;
+      if((addr + i) & 1) m->flash[(addr + i) >> 1] = (m->flash[(addr + i) >> 1] & 0x00FF) | (byte << 8);
+      else               m->flash[(addr + i) >> 1] = (m->flash[(addr + i) >> 1] & 0xFF00) | byte;
+      total++;
+    }
+  }
+  fclose(f);
+  return total;
+}
+
+// Execute one instruction (or one clock cycle while sleeping/halted)
+int avr_step(avr_t *m) {
+  uint8_t vect;
+  int     cyc;
+
+  if(m->fault) return 0;
+
+  // Sleeping: wait for an enabled interrupt
+  if(m->sleep) {
+    if(!FLAG(AVR_SREG_I) || !(vect = pending(m))) {
+      if(!FLAG(AVR_SREG_I) && m->sleep == AVR_PWRDOWN && !(R(AVR_WDTCR) & 0x08)) {
+        m->fault   = AVR_EHALT;
+        m->faultpc = m->pc;
+        return 0;
+      }
+      tick(m, 1);
+      return 1;
+    }
+    m->halt  = ((m->sleep == AVR_PWRDOWN) ? STARTUPCK : 0) + 4;
+    m->sleep = AVR_AWAKE;
+  }
+
+  // MCU halted after wake-up
+  if(m->halt) {
+    cyc = m->halt;
+    m->halt = 0;
+    tick(m, cyc);
+    return cyc;
+  }
+
+  // Interrupt dispatch
+  if(!m->intlock && FLAG(AVR_SREG_I) && (vect = pending(m))) return dispatch(m, vect);
+  m->intlock = 0;
+
+  // Execute instruction
+  cyc = execute(m);
+  if(cyc) tick(m, cyc);
+  return cyc;
+}
+
+// Fault description
+const char *avr_strfault(uint8_t fault) {
+  switch(fault) {
+    case AVR_OK:       return "no fault";
+    case AVR_EILLEGAL: return "illegal or unsupported instruction";
+    case AVR_EADDRESS: return "data access outside of data space";
+    case AVR_EFLASH:   return "program counter outside of flash";
+    case AVR_EHALT:    return "power-down with interrupts disabled";
+    default:           return "unknown fault";
+  }
+}
@@ -0,0 +1,143 @@
+// ===================================================================================
+// Project:   TinyCandle - Instruction Level Simulator for ATtiny13A
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Cycle counting simulator of the ATtiny13A core. It executes the firmware hex file
+// and models the peripherals the TinyCandle firmware uses: PORTB with pull-ups and an
+// externally driven button, Timer0 in all waveform generation modes including the
+// double buffered OCR registers and the OC0A/OC0B compare outputs, the pin change
+// interrupt, INT0, the watchdog interrupt and the sleep modes with wake-up latency.
+// The hooks allow tools to observe every simulated clock cycle.
+
+#ifndef AVRSIM_H
+#define AVRSIM_H
+
+#include <stdint.h>
+
+// Memory sizes of ATtiny13A
+#define AVR_FLASHWORDS  512       // 1 KB flash
+#define AVR_DATASIZE    0xA0      // 32 registers + 64 I/O + 64 bytes SRAM
+#define AVR_RAMSTART    0x60
+#define AVR_RAMEND      0x9F
+
+// I/O register addresses (data space)
+#define AVR_PINB        (0x16 + 0x20)
+#define AVR_DDRB        (0x17 + 0x20)
+#define AVR_PORTB       (0x18 + 0x20)
+#define AVR_PCMSK       (0x15 + 0x20)
+#define AVR_WDTCR       (0x21 + 0x20)
+#define AVR_PRR         (0x25 + 0x20)
+#define AVR_OCR0B       (0x29 + 0x20)
+#define AVR_TCCR0A      (0x2F + 0x20)
+#define AVR_TCNT0       (0x32 + 0x20)
+#define AVR_TCCR0B      (0x33 + 0x20)
+#define AVR_MCUCR       (0x35 + 0x20)
+#define AVR_OCR0A       (0x36 + 0x20)
+#define AVR_TIFR0       (0x38 + 0x20)
+#define AVR_TIMSK0      (0x39 + 0x20)
+#define AVR_GIFR        (0x3A + 0x20)
+#define AVR_GIMSK       (0x3B + 0x20)
+#define AVR_SPL         (0x3D + 0x20)
+#define AVR_SREG        (0x3F + 0x20)
+
+// Status register bits
+#define AVR_SREG_C      0
+#define AVR_SREG_Z      1
+#define AVR_SREG_N      2
+#define AVR_SREG_V      3
+#define AVR_SREG_S      4
+#define AVR_SREG_H      5
+#define AVR_SREG_T      6
+#define AVR_SREG_I      7
+
+// Interrupt flag bits
+#define AVR_TOV0        1         // TIFR0
+#define AVR_OCF0A       2         // TIFR0
+#define AVR_OCF0B       3         // TIFR0
+#define AVR_PCIF        5         // GIFR
+#define AVR_INTF0       6         // GIFR
+
+// Sleep states
+#define AVR_AWAKE       0
+#define AVR_IDLE        1
+#define AVR_ADCNR       2
+#define AVR_PWRDOWN     3
+
+// Fault codes (simulation stops when a fault occurs)
+#define AVR_OK          0
+#define AVR_EILLEGAL    1         // unsupported or illegal opcode
+#define AVR_EADDRESS    2         // data access outside of data space
+#define AVR_EFLASH      3         // program counter outside of flash
+#define AVR_EHALT       4         // sleep with interrupts disabled (never wakes)
+
+typedef struct avr avr_t;
+typedef void (*avr_hook_t)(avr_t *m, void *ctx);
+typedef void (*avr_memhook_t)(avr_t *m, uint16_t addr, uint8_t value, uint8_t write, void *ctx);
+
+struct avr {
+  uint16_t flash[AVR_FLASHWORDS]; // program memory
+  uint8_t  data[AVR_DATASIZE];    // registers, I/O and SRAM
+  uint16_t pc;                    // program counter (word address)
+  uint64_t cycles;                // elapsed clock cycles
+  uint32_t freq;                  // clock frequency in Hz
+  uint8_t  sleep;                 // current sleep state
+  uint8_t  isr;                   // nesting depth of interrupt service routines
+  uint8_t  fault;                 // fault code
+  uint8_t  spmin;                 // lowest stack pointer value seen (high-water mark)
+  uint16_t faultpc;               // program counter at fault
+
+  // Pins
+  uint8_t  extdrive;              // pins driven from outside (e.g. pressed button)
+  uint8_t  extlevel;              // level of the externally driven pins
+  uint8_t  pins;                  // current pin levels
+  uint8_t  pcprev;                // pin levels at last pin change detection
+
+  // Timer0
+  uint16_t prescnt;               // prescaler counter
+  uint8_t  ocra;                  // active compare values (double buffered in PWM)
+  uint8_t  ocrb;
+  uint8_t  oc0a;                  // compare output latches
+  uint8_t  oc0b;
+  uint8_t  down;                  // phase correct PWM counting down
+
+  // Watchdog and wake-up
+  uint32_t wdtcnt;                // watchdog cycle counter
+  uint8_t  halt;                  // remaining cycles until CPU executes again
+  uint8_t  intlock;               // execute one more instruction before interrupts
+  uint8_t  forced;                // vector raised by a tool regardless of flags and masks
+
+  // Observation hook, called once for every simulated clock cycle
+  avr_hook_t cyclehook;
+  void      *hookctx;
+
+  // Data space hook, called for every load, store, in, out and stack access
+  avr_memhook_t memhook;
+  void         *memctx;
+};
+
+// Initialize and reset the simulator, load firmware from Intel hex file
+void avr_init(avr_t *m, uint32_t freq);
+void avr_reset(avr_t *m);
+int  avr_loadhex(avr_t *m, const char *filename);
+
+// Execute one instruction (or one cycle while sleeping), returns cycles used
+int  avr_step(avr_t *m);
+
+// Set external level of a pin (drive = 0 releases the pin)
+void avr_setpin(avr_t *m, uint8_t pin, uint8_t drive, uint8_t level);
+
+// Raise interrupt vector (1-9) as if its flag were set and enabled, it is taken like
+// any other interrupt as soon as the I flag allows
+void avr_interrupt(avr_t *m, uint8_t vect);
+
+// Fault description
+const char *avr_strfault(uint8_t fault);
+
+#endif
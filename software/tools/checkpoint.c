@@ -0,0 +1,298 @@
+// ===================================================================================
+// Project:   TinyCandle - Checkpoint Journal
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "checkpoint.h"
+
+#define JOURNAL_MAGIC 0x4b434354  // "TCCK"
+#define RECORD_MAGIC  0x43455254  // "TREC"
+#define COMPACTMIN    65536       // minimum journal length for compaction
+
+// Journal header
+typedef struct {
+  uint32_t magic;
+  uint32_t id;
+  uint32_t ntasks;
+  uint32_t size;
+  uint32_t crc;                   // CRC of the fields above
+} header_t;
+
+// Record header, followed by the state
+typedef struct {
+  uint32_t magic;
+  uint32_t task;
+  uint32_t crc;                   // CRC of task and state
+} record_t;
+
+#define RECSIZE(c)    (sizeof(record_t) + (c)->size)
+
+static uint32_t crctable[256];
+
+// CRC-32 (IEEE) table
+static void crc32_init(void) {
+  int i, j;
+  for(i = 0; i < 256; i++) {
+    uint32_t r = i;
+    for(j = 0; j < 8; j++) r = (r >> 1) ^ (-(r & 1) & 0xEDB88320);
+    crctable[i] = r;
+  }
+}
+
+static uint32_t crc32(uint32_t crc, const void *data, size_t len) {
+  const uint8_t *p = data;
+  crc = ~crc;
+  while(len--) crc = crctable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+uint32_t checkpoint_hash(uint32_t h, const void *data, size_t len) {
+  const uint8_t *p = data;
+  if(!h) h = 2166136261u;
+  while(len--) h = (h ^ *p++) * 16777619u;
+  return h;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void make_header(const checkpoint_t *c, header_t *h) {
+  h->magic  = JOURNAL_MAGIC;
+  h->id     = c->id;
+  h->ntasks = c->ntasks;
+  h->size   = c->size;
+  h->crc    = crc32(0, h, offsetof(header_t, crc));
+}
+
+// Append record of task to buffer, returns its length
+static size_t make_record(const checkpoint_t *c, uint32_t task, uint8_t *buf) {
+  record_t r;
+  r.magic = RECORD_MAGIC;
+  r.task  = task;
+  r.crc   = crc32(crc32(0, &task, sizeof(task)), c->state + (size_t)task * c->size, c->size);
+  memcpy(buf, &r, sizeof(r));
+  memcpy(buf + sizeof(r), c->state + (size_t)task * c->size, c->size);
+  return RECSIZE(c);
+}
+
+// Write all of buf at offset
+static int writeall(int fd, const uint8_t *buf, size_t len, off_t offset) {
+  while(len) {
+    ssize_t n = pwrite(fd, buf, len, offset);
+    if(n <= 0) return -1;
+    buf += n;
+    len -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+// Sync directory after rename
+static void syncdir(const char *filename) {
+  char *copy = strdup(filename);
+  int   fd   = open(dirname(copy), O_RDONLY);
+  if(fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+  free(copy);
+}
+
+// Replay records up to the first damaged one and cut the journal there
+static int replay(checkpoint_t *c, const uint8_t *data, off_t length) {
+  off_t pos = sizeof(header_t);
+  int   n = 0;
+  while(pos + (off_t)RECSIZE(c) <= length) {
+    record_t r;
+    memcpy(&r, data + pos, sizeof(r));
+    if(r.magic != RECORD_MAGIC || r.task >= c->ntasks ||
+       r.crc != crc32(crc32(0, &r.task, sizeof(r.task)), data + pos + sizeof(r), c->size)) break;
+    memcpy(c->state + (size_t)r.task * c->size, data + pos + sizeof(r), c->size);
+    n += !c->valid[r.task];
+    c->valid[r.task] = 1;
+    pos += RECSIZE(c);
+  }
+  c->length = pos;
+  if(pos < length && (ftruncate(c->fd, pos) || fdatasync(c->fd))) return -1;
+  return n;
+}
+
+int checkpoint_open(checkpoint_t *c, const char *filename, uint32_t id, uint32_t ntasks, uint32_t size) {
+  header_t h, f;
+  uint8_t *data;
+  off_t    length;
+  int      n = 0;
+
+  crc32_init();
+  memset(c, 0, sizeof(*c));
+  c->id       = id;
+  c->ntasks   = ntasks;
+  c->size     = size;
+  c->interval = CHECKPOINT_INTERVAL;
+  c->last     = now();
+  c->filename = strdup(filename);
+  c->state    = calloc(ntasks, size);
+  c->valid    = calloc(ntasks, 1);
+  c->dirty    = calloc(ntasks, 1);
+  c->buffer   = malloc((size_t)ntasks * RECSIZE(c));
+  c->fd       = open(filename, O_RDWR | O_CREAT, 0644);
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_mutex_init(&c->io, NULL);
+  if(!c->filename || !c->state || !c->valid || !c->dirty || !c->buffer || c->fd < 0) goto fail;
+  make_header(c, &h);
+
+  // Existing journal of the same run
+  length = lseek(c->fd, 0, SEEK_END);
+  if(length >= (off_t)sizeof(header_t)) {
+    if(!(data = malloc(length))) goto fail;
+    if(pread(c->fd, data, length, 0) != length) {
+      free(data);
+      goto fail;
+    }
+    memcpy(&f, data, sizeof(f));
+    if(memcmp(&f, &h, sizeof(h))) {
+      free(data);
+      goto fail;
+    }
+    n = replay(c, data, length);
+    free(data);
+    if(n < 0) goto fail;
+    return n;
+  }
+
+  // New journal (or only a torn header of one)
+  if(ftruncate(c->fd, 0) || writeall(c->fd, (uint8_t *)&h, sizeof(h), 0) || fsync(c->fd)) goto fail;
+  syncdir(filename);
+  c->length = sizeof(h);
+  return 0;
+
+fail:
+  if(c->fd >= 0) close(c->fd);
+  c->fd = -1;
+  free(c->filename);
+  free(c->state);
+  free(c->valid);
+  free(c->dirty);
+  free(c->buffer);
+  return -1;
+}
+
+const void *checkpoint_get(checkpoint_t *c, uint32_t task) {
+  return c->valid[task] ? c->state + (size_t)task * c->size : NULL;
+}
+
+void checkpoint_put(checkpoint_t *c, uint32_t task, const void *state) {
+  pthread_mutex_lock(&c->lock);
+  memcpy(c->state + (size_t)task * c->size, state, c->size);
+  c->valid[task] = 1;
+  c->dirty[task] = 1;
+  pthread_mutex_unlock(&c->lock);
+}
+
+// Write all states to a new journal and replace the old one. The records overwrite
+// the buffer, so on failure all states are retried at the next sync.
+static int compact(checkpoint_t *c) {
+  char     tmp[4096];
+  header_t h;
+  size_t   len = 0;
+  uint32_t t;
+  int      fd;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", c->filename);
+  if((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) goto fail;
+  make_header(c, &h);
+  pthread_mutex_lock(&c->lock);
+  for(t = 0; t < c->ntasks; t++) {
+    if(!c->valid[t]) continue;
+    len += make_record(c, t, c->buffer + len);
+    c->dirty[t] = 0;
+  }
+  pthread_mutex_unlock(&c->lock);
+  if(writeall(fd, (uint8_t *)&h, sizeof(h), 0) || writeall(fd, c->buffer, len, sizeof(h)) ||
+     fsync(fd) || rename(tmp, c->filename)) {
+    close(fd);
+    unlink(tmp);
+    goto fail;
+  }
+  syncdir(c->filename);
+  close(c->fd);
+  c->fd     = fd;
+  c->length = sizeof(h) + len;
+  return 0;
+
+fail:
+  pthread_mutex_lock(&c->lock);
+  for(t = 0; t < c->ntasks; t++) c->dirty[t] |= c->valid[t];
+  pthread_mutex_unlock(&c->lock);
+  return -1;
+}
+
+int checkpoint_due(const checkpoint_t *c) {
+  return now() - c->last >= c->interval;
+}
+
+int checkpoint_sync(checkpoint_t *c, int force) {
+  double   t = now();
+  size_t   len = 0, i;
+  uint32_t task;
+  int      err = 0, nvalid = 0;
+
+  if(!force && t - c->last < c->interval) return 0;
+  if(force) pthread_mutex_lock(&c->io);
+  else if(pthread_mutex_trylock(&c->io)) return 0;
+
+  // Collect changed states
+  pthread_mutex_lock(&c->lock);
+  for(task = 0; task < c->ntasks; task++) {
+    nvalid += c->valid[task];
+    if(!c->dirty[task]) continue;
+    len += make_record(c, task, c->buffer + len);
+    c->dirty[task] = 0;
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  // Append them, or compact the journal if it has grown too long
+  if(len) {
+    if(c->length + (off_t)len > COMPACTMIN &&
+       c->length + (off_t)len > 4 * (off_t)(sizeof(header_t) + nvalid * RECSIZE(c))) {
+      err = compact(c);
+    } else if(writeall(c->fd, c->buffer, len, c->length) || fdatasync(c->fd)) {
+      // Retry the states of the failed append at the next sync
+      err = -1;
+      pthread_mutex_lock(&c->lock);
+      for(i = 0; i < len; i += RECSIZE(c)) c->dirty[((record_t *)(c->buffer + i))->task] = 1;
+      pthread_mutex_unlock(&c->lock);
+    } else c->length += len;
+  }
+  c->last = t;
+  pthread_mutex_unlock(&c->io);
+  return err;
+}
+
+int checkpoint_close(checkpoint_t *c) {
+  int err = checkpoint_sync(c, 1);
+  err |= close(c->fd);
+  pthread_mutex_destroy(&c->lock);
+  pthread_mutex_destroy(&c->io);
+  free(c->filename);
+  free(c->state);
+  free(c->valid);
+  free(c->dirty);
+  free(c->buffer);
+  return err ? -1 : 0;
+}
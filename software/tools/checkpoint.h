@@ -0,0 +1,74 @@
+// ===================================================================================
+// Project:   TinyCandle - Checkpoint Journal
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Crash-consistent checkpoints of long sweeps and soak runs. A run consists of a fixed
+// number of tasks, each with a state of fixed size (e.g. the result of a configuration
+// or the engine state and RNG position of a soak run). Tasks store their state with
+// checkpoint_put(), which only copies it into memory. checkpoint_sync() appends the
+// states changed since the last sync as records with a CRC to the journal file and
+// flushes it to disk, at most once per interval, so it can be called as often as
+// convenient. On open, the journal is replayed up to the first incomplete or damaged
+// record (the one being written during a crash), so every task resumes from its last
+// complete checkpoint. When the journal has grown to several times the size of all
+// states, it is compacted into a new file which atomically replaces the old one.
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define CHECKPOINT_INTERVAL 5.0   // default seconds between syncs
+
+// Checkpoint journal
+typedef struct {
+  int             fd;
+  char           *filename;
+  uint32_t        id;             // hash of the run parameters
+  uint32_t        ntasks;
+  uint32_t        size;           // state size per task
+  uint8_t        *state;          // latest state of every task
+  uint8_t        *valid;          // task has a state
+  uint8_t        *dirty;          // state changed since the last sync
+  uint8_t        *buffer;         // records of a sync
+  off_t           length;         // journal length
+  double          interval;       // minimum seconds between syncs
+  double          last;           // time of the last sync
+  pthread_mutex_t lock;           // states
+  pthread_mutex_t io;             // journal file
+} checkpoint_t;
+
+// Open journal and replay it or create a new one, returns number of tasks with a state
+// or -1 on error (also if the journal belongs to a run with other parameters)
+int  checkpoint_open(checkpoint_t *c, const char *filename, uint32_t id, uint32_t ntasks, uint32_t size);
+
+// Last state of task, NULL if none
+const void *checkpoint_get(checkpoint_t *c, uint32_t task);
+
+// Set state of task (thread-safe)
+void checkpoint_put(checkpoint_t *c, uint32_t task, const void *state);
+
+// Interval since the last sync has elapsed, for tasks which must flush other output
+// before their state can be checkpointed
+int  checkpoint_due(const checkpoint_t *c);
+
+// Write changed states if the interval has elapsed or force is set (thread-safe),
+// returns 0 on success
+int  checkpoint_sync(checkpoint_t *c, int force);
+
+// Final sync and close
+int  checkpoint_close(checkpoint_t *c);
+
+// FNV-1a hash of run parameters, start with h = 0
+uint32_t checkpoint_hash(uint32_t h, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,355 @@
+// ===================================================================================
+// Project:   TinyCandle - Energy-Optimal Configuration Search
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Searches the configuration space of the firmware (clock, frame delay, PWM prescaler,
+// fast or phase correct PWM and flame engine) for the best trade-offs between energy
+// and look. Every configuration is simulated with the bit-exact host model of the
+// firmware in parallel threads. The supply current follows from the power model of
+// the board (datasheet values or coefficients calibrated by powercal) and the
+// simulated PWM duty cycles. The look is rated by the spectral
+// error of the flicker against a reference (engine at clock and delay as shipped)
+// and by the PWM frequency (stroboscopic effects). The Pareto frontier of energy,
+// spectral error and PWM frequency is printed together with the makefile and #define
+// settings of every point. Long sweeps can be checkpointed (-k): the results of the
+// evaluated configurations are journaled every few seconds, and an interrupted sweep
+// continues where it stopped with the same results, whatever the number of threads.
+//
+// Usage:
+// ------
+// energyopt [options]
+//   -j N       number of threads (default number of CPUs)
+//   -n N       frames simulated per configuration (default 65536)
+//   -d MIN:MAX range of CANDLEDELAY in ms (default 1:40)
+//   -m FPS     minimum frame rate (default 20)
+//   -p HZ      minimum PWM frequency (default 250)
+//   -c E:CYC   busy cycles per frame of engine E (default 0:790 from tinysim -q of the
+//              shipped hex, 1:850 estimated)
+//   -r E       engine of the reference look (default 0, spring)
+//   -a         print all feasible configurations, not only the Pareto frontier
+//   -b REV     board revision with calibrated power model (see powercal)
+//   -f FILE    file of the board revisions (default boards.txt)
+//   -k FILE    checkpoint journal to resume an interrupted sweep
+//   -i SEC     seconds between checkpoints (default 5)
+
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "checkpoint.h"
+#include "engine.h"
+#include "power.h"
+#include "spectrum.h"
+
+// Search settings
+#define SEGMENT       1024        // Welch segment length in frames
+#define NFREQ         32          // frequencies of the spectral error
+#define FMIN          0.3         // lowest frequency of the spectral error in Hz
+#define FMAX          8.0         // highest frequency of the spectral error in Hz
+#define MAXTHREADS    64
+#define REFCLOCK      1200000     // reference: firmware as shipped
+#define REFDELAY      CANDLEDELAY
+
+// Clock settings (internal RC oscillator with or without CKDIV8)
+static const struct {
+  uint32_t fcpu;
+  uint8_t  lfuse;
+} clocks[] = {
+  {9600000, 0x3a}, {4800000, 0x39}, {1200000, 0x2a}, {600000, 0x29}, {128000, 0x3b}
+};
+#define NCLOCKS       (sizeof(clocks) / sizeof(clocks[0]))
+
+// Timer0 prescalers
+static const uint8_t prescalers[] = {1, 8, 64};
+#define NPRESC        (sizeof(prescalers) / sizeof(prescalers[0]))
+
+// Busy cycles per frame (updateCandle and loop) of the engines: busy field of tinysim -q
+// for tinycandle.hex (spring), estimate for the IIR engine (not shipped as hex)
+static double framecycles[2] = {790, 850};
+
+// Configuration and its results
+typedef struct {
+  uint8_t clock;                  // index into clocks
+  uint8_t delay;                  // CANDLEDELAY in ms
+  uint8_t presc;                  // Timer0 prescaler
+  uint8_t mode;                   // 0: fast PWM, 1: phase correct PWM
+  uint8_t engine;                 // flame engine
+  double  fps;                    // frame rate
+  double  fpwm;                   // PWM frequency
+  double  current;                // mean supply current (mA)
+  double  energy;                 // energy per hour (mWh)
+  double  specerr;                // RMS spectral error against reference (dB)
+  int     feasible;
+  int     evaluated;
+  int     pareto;
+} config_t;
+
+static config_t *configs;
+static int       nconfigs, nextconfig, nframes = 65536;
+static double    refpsd[NFREQ];   // reference spectral density
+static double    grid[NFREQ];
+static power_t   power;           // power model of the board
+static const power_t *board = &power;
+static checkpoint_t *journal;     // checkpoints of the results, NULL if none
+
+// ===================================================================================
+// Evaluation
+// ===================================================================================
+
+// Frame rate: delay plus busy cycles of the engine
+static double framerate(uint32_t fcpu, int delay, int engine) {
+  return 1.0 / (delay / 1000.0 + framecycles[engine] / fcpu);
+}
+
+// Simulate engine, returns mean duty cycles and spectral density on the grid
+static void simulate(int engine, int mode, double fps, double *dutya, double *dutyb, double *dens) {
+  double  *x   = malloc(nframes * sizeof(double));
+  double  *psd = malloc((SEGMENT / 2 + 1) * sizeof(double));
+  double   suma = 0, sumb = 0;
+  candle_t c;
+  int      i;
+
+  candle_init(&c, engine, 0);
+  for(i = 0; i < nframes; i++) {
+    double a, b;
+    candle_update(&c);
+    // Fast PWM: (OCR + 1) / 256, phase correct PWM: OCR / 255
+    a = mode ? c.ocra / 255.0 : (c.ocra + 1) / 256.0;
+    b = mode ? c.ocrb / 255.0 : (c.ocrb + 1) / 256.0;
+    suma += a;
+    sumb += b;
+    x[i] = a;
+  }
+  *dutya = suma / nframes;
+  *dutyb = sumb / nframes;
+
+  // Spectral density per Hz of the brightness of one LED pair
+  psd_welch(x, nframes, SEGMENT, psd);
+  for(i = 0; i < NFREQ; i++) dens[i] = psd_at(psd, SEGMENT, fps, grid[i]) / fps;
+  free(x);
+  free(psd);
+}
+
+// Evaluate one configuration
+static void evaluate(config_t *cfg) {
+  double fcpu = clocks[cfg->clock].fcpu, dutya, dutyb, dens[NFREQ], err = 0;
+  int    i;
+
+  cfg->fps  = framerate(fcpu, cfg->delay, cfg->engine);
+  cfg->fpwm = fcpu / cfg->presc / (cfg->mode ? 510.0 : 256.0);
+  simulate(cfg->engine, cfg->mode, cfg->fps, &dutya, &dutyb, dens);
+  cfg->current = power_total(board, fcpu, dutya, dutyb, cfg->fpwm);
+  cfg->energy  = board->vcc * cfg->current;
+  for(i = 0; i < NFREQ; i++) {
+    double db = 10 * log10((dens[i] + 1e-12) / (refpsd[i] + 1e-12));
+    err += db * db;
+  }
+  cfg->specerr = sqrt(err / NFREQ);
+}
+
+// Worker thread
+static void *worker(void *arg) {
+  int i;
+  (void)arg;
+  while((i = __sync_fetch_and_add(&nextconfig, 1)) < nconfigs) {
+    if(!configs[i].feasible || configs[i].evaluated) continue;
+    evaluate(&configs[i]);
+    configs[i].evaluated = 1;
+    if(journal) {
+      checkpoint_put(journal, i, &configs[i]);
+      checkpoint_sync(journal, 0);
+    }
+  }
+  return NULL;
+}
+
+// a dominates b: not worse in energy, spectral error and PWM frequency, better in one
+static int dominates(const config_t *a, const config_t *b) {
+  if(a->energy > b->energy || a->specerr > b->specerr || a->fpwm < b->fpwm) return 0;
+  return a->energy < b->energy || a->specerr < b->specerr || a->fpwm > b->fpwm;
+}
+
+// Sort by energy
+static int cmpenergy(const void *a, const void *b) {
+  double d = ((const config_t *)a)->energy - ((const config_t *)b)->energy;
+  return (d > 0) - (d < 0);
+}
+
+// ===================================================================================
+// Main
+// ===================================================================================
+
+// Print usage
+static void usage(void) {
+  fprintf(stderr,
+    "Usage: energyopt [options]\n"
+    "  -j N       number of threads (default number of CPUs)\n"
+    "  -n N       frames simulated per configuration (default 65536)\n"
+    "  -d MIN:MAX range of CANDLEDELAY in ms (default 1:40)\n"
+    "  -m FPS     minimum frame rate (default 20)\n"
+    "  -p HZ      minimum PWM frequency (default 250)\n"
+    "  -c E:CYC   busy cycles per frame of engine E (default 0:790 from tinysim -q of the\n"
+    "             shipped hex, 1:850 estimated)\n"
+    "  -r E       engine of the reference look (default 0, spring)\n"
+    "  -a         print all feasible configurations, not only the Pareto frontier\n"
+    "  -b REV     board revision with calibrated power model (see powercal)\n"
+    "  -f FILE    file of the board revisions (default " POWER_FILE ")\n"
+    "  -k FILE    checkpoint journal to resume an interrupted sweep\n"
+    "  -i SEC     seconds between checkpoints (default 5)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  pthread_t threads[MAXTHREADS];
+  double    minfps = 20, minpwm = 250, dummy;
+  int       nthreads = sysconf(_SC_NPROCESSORS_ONLN), dmin = 1, dmax = 40, all = 0;
+  int       opt, i, n, feasible = 0, npareto = 0, refengine = ENGINE_SPRING;
+  size_t    c, p;
+  const char *rev = NULL, *powerfile = POWER_FILE, *ckptfile = NULL;
+  checkpoint_t ckpt;
+  double    interval = CHECKPOINT_INTERVAL;
+
+  while((opt = getopt(argc, argv, "j:n:d:m:p:c:r:ab:f:k:i:h")) != -1) {
+    switch(opt) {
+      case 'j': nthreads = atoi(optarg); break;
+      case 'n': nframes  = atoi(optarg); break;
+      case 'd': if(sscanf(optarg, "%d:%d", &dmin, &dmax) != 2) usage(); break;
+      case 'm': minfps   = atof(optarg); break;
+      case 'p': minpwm   = atof(optarg); break;
+      case 'c': {
+        int e;
+        double cyc;
+        if(sscanf(optarg, "%d:%lf", &e, &cyc) != 2 || e < 0 || e > 1) usage();
+        framecycles[e] = cyc;
+        break;
+      }
+      case 'r': refengine = atoi(optarg) ? ENGINE_IIR : ENGINE_SPRING; break;
+      case 'a': all = 1; break;
+      case 'b': rev = optarg; break;
+      case 'f': powerfile = optarg; break;
+      case 'k': ckptfile  = optarg; break;
+      case 'i': interval  = atof(optarg); break;
+      default:  usage();
+    }
+  }
+  power = power_default;
+  if(rev && power_load(&power, powerfile, rev)) {
+    fprintf(stderr, "Error: board %s not found in %s\n", rev, powerfile);
+    return 1;
+  }
+  if(nthreads < 1) nthreads = 1;
+  if(nthreads > MAXTHREADS) nthreads = MAXTHREADS;
+  if(nframes < 4 * SEGMENT || dmin < 0 || dmax < dmin || dmax > 255) usage();
+
+  // Reference spectrum: clock and delay as shipped
+  for(i = 0; i < NFREQ; i++) grid[i] = FMIN * pow(FMAX / FMIN, (double)i / (NFREQ - 1));
+  simulate(refengine, 0, framerate(REFCLOCK, REFDELAY, refengine), &dummy, &dummy, refpsd);
+
+  // Configuration space
+  nconfigs = NCLOCKS * (dmax - dmin + 1) * NPRESC * 2 * 2;
+  configs  = calloc(nconfigs, sizeof(config_t));
+  if(!configs) {
+    fprintf(stderr, "Error: out of memory\n");
+    return 1;
+  }
+  n = 0;
+  for(c = 0; c < NCLOCKS; c++)
+    for(i = dmin; i <= dmax; i++)
+      for(p = 0; p < NPRESC; p++)
+        for(opt = 0; opt < 4; opt++) {
+          config_t *cfg = &configs[n++];
+          double    fcpu = clocks[c].fcpu;
+          cfg->clock  = c;
+          cfg->delay  = i;
+          cfg->presc  = prescalers[p];
+          cfg->mode   = opt & 1;
+          cfg->engine = opt >> 1;
+          cfg->feasible = framerate(fcpu, i, cfg->engine) >= minfps &&
+                          fcpu / cfg->presc / (cfg->mode ? 510.0 : 256.0) >= minpwm;
+          feasible += cfg->feasible;
+        }
+
+  // Results of an interrupted sweep with the same parameters
+  if(ckptfile) {
+    uint32_t id = checkpoint_hash(0, &nframes, sizeof(nframes));
+    int      resumed;
+    id = checkpoint_hash(id, framecycles, sizeof(framecycles));
+    id = checkpoint_hash(id, &refengine, sizeof(refengine));
+    id = checkpoint_hash(id, &power.vcc, offsetof(power_t, leds) - offsetof(power_t, vcc));
+    id = checkpoint_hash(id, &power.leds, sizeof(power.leds));
+    for(i = 0; i < nconfigs; i++) id = checkpoint_hash(id, &configs[i], offsetof(config_t, fps));
+    if((resumed = checkpoint_open(&ckpt, ckptfile, id, nconfigs, sizeof(config_t))) < 0) {
+      fprintf(stderr, "Error: cannot open checkpoint %s (journal of another sweep?)\n", ckptfile);
+      return 1;
+    }
+    ckpt.interval = interval;
+    journal = &ckpt;
+    for(i = 0; i < nconfigs; i++)
+      if(checkpoint_get(journal, i)) memcpy(&configs[i], checkpoint_get(journal, i), sizeof(config_t));
+    if(resumed) printf("Resuming %d evaluated configurations from %s\n", resumed, ckptfile);
+  }
+
+  // Evaluate in parallel
+  printf("Evaluating %d configurations (%d feasible) with %d threads ...\n", nconfigs, feasible, nthreads);
+  for(i = 0; i < nthreads; i++) pthread_create(&threads[i], NULL, worker, NULL);
+  for(i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+  if(journal && checkpoint_close(journal)) {
+    fprintf(stderr, "Error: cannot write checkpoint %s\n", ckptfile);
+    return 1;
+  }
+
+  // Pareto frontier
+  for(i = 0; i < nconfigs; i++) {
+    if(!configs[i].feasible) continue;
+    configs[i].pareto = 1;
+    for(n = 0; n < nconfigs && configs[i].pareto; n++)
+      if(configs[n].feasible && dominates(&configs[n], &configs[i])) configs[i].pareto = 0;
+    npareto += configs[i].pareto;
+  }
+  qsort(configs, nconfigs, sizeof(config_t), cmpenergy);
+
+  // Table
+  printf("Board %s, reference: %s engine, CANDLEDELAY %d @ %.1f MHz (%.1f fps)\n\n",
+         board->board, refengine ? "iir" : "spring", REFDELAY, REFCLOCK / 1e6,
+         framerate(REFCLOCK, REFDELAY, refengine));
+  printf("  #  energy/h  current  spec.err   PWM freq    fps    clock  mode   presc  engine  delay\n");
+  for(i = 0, n = 0; i < nconfigs; i++) {
+    config_t *cfg = &configs[i];
+    if(!cfg->feasible || (!all && !cfg->pareto)) continue;
+    printf("%3d %5.1f mWh %5.2f mA %6.2f dB %7.0f Hz %6.1f %5.2f MHz  %s %6d  %6s %4d ms%s\n",
+           ++n, cfg->energy, cfg->current, cfg->specerr, cfg->fpwm, cfg->fps,
+           clocks[cfg->clock].fcpu / 1e6, cfg->mode ? "phase" : "fast ", cfg->presc,
+           cfg->engine ? "iir" : "spring", cfg->delay, (all && cfg->pareto) ? " *" : "");
+  }
+
+  // Settings of the Pareto frontier
+  printf("\nSettings of the %d Pareto-optimal configurations:\n", npareto);
+  for(i = 0, n = 0; i < nconfigs; i++) {
+    config_t *cfg = &configs[i];
+    if(!cfg->feasible || !cfg->pareto) continue;
+    printf("\n[%d] %.1f mWh, %.2f dB, %.0f Hz PWM\n", ++n, cfg->energy, cfg->specerr, cfg->fpwm);
+    printf("makefile:\n");
+    printf("  CLOCK    = %u\n", clocks[cfg->clock].fcpu);
+    printf("  LFUSE    = 0x%02x\n", clocks[cfg->clock].lfuse);
+    printf("config.h:\n");
+    printf("  #define CANDLEDELAY   %d\n", cfg->delay);
+    printf("  #define ENGINE        %d\n", cfg->engine);
+    printf("  #define PWMMODE       %d\n", cfg->mode);
+    printf("  #define PWMPRESC      %d\n", cfg->presc);
+    if(clocks[cfg->clock].fcpu < 1000000)
+      printf("  (programmer clock must be below %.0f kHz, e.g. avrdude -B %d)\n",
+             clocks[cfg->clock].fcpu / 4000.0, clocks[cfg->clock].fcpu < 200000 ? 32 : 8);
+  }
+  free(configs);
+  return 0;
+}
@@ -0,0 +1,140 @@
+// ===================================================================================
+// Project:   TinyCandle - Host Model of the Candle Simulation
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+
+#include "engine.h"
+
+// Default filter of the firmware (IIR_A1, IIR_A2 and IIR_SHIFT in TinyCandle.ino)
+const iir_t iir_default = {
+  .a1    = {2, {+1, -1},     {-1, 2}},
+  .a2    = {3, {+1, +1, -1}, { 0, 7, 3}},
+  .shift = 2
+};
+
+// Initialize candle with firmware start values
+void candle_init(candle_t *c, uint8_t engine, uint16_t seed) {
+  c->rn        = seed ? seed : LFSRSEED;
+  c->taps      = LFSRTAPS;
+  c->engine    = engine;
+  c->iir       = &iir_default;
+  c->uncalm    = MINUNCALM;
+  c->uncalmdir = UNCALMINC;
+  c->cnt       = 0;
+  if(engine == ENGINE_IIR) {
+    c->centerx = 0;
+    c->centery = 0;
+  } else {
+    c->centerx = MAXDEV;
+    c->centery = MAXDEV / 2;
+  }
+  c->xvel = 0;
+  c->yvel = 0;
+  c->ocra = 0;
+  c->ocrb = 0;
+}
+
+// Pseudo random number generator (Galois LFSR)
+uint16_t candle_prng(candle_t *c, uint16_t maxvalue) {
+  c->rn = (c->rn >> 1) ^ (-(c->rn & 1) & c->taps);
+  return c->rn % maxvalue;
+}
+
+// Evaluate sum of powers of two with 16-bit wrap-around like avr-gcc
+int16_t iir_apply(const iircoef_t *a, int16_t y) {
+  int32_t sum = 0;
+  int     i;
+  for(i = 0; i < a->n; i++) {
+    int16_t term = (a->shift[i] < 0) ? (int16_t)(y << 1) : (int16_t)(y >> a->shift[i]);
+    sum += a->sign[i] * term;
+  }
+  return (int16_t)sum;
+}
+
+// Real value of coefficient
+double iir_value(const iircoef_t *a) {
+  double sum = 0;
+  int    i;
+  for(i = 0; i < a->n; i++)
+    sum += a->sign[i] * ((a->shift[i] < 0) ? 2.0 : 1.0 / (1 << a->shift[i]));
+  return sum;
+}
+
+// Clamp to range
+static int16_t clamp(int16_t v, int16_t limit) {
+  if(v < -limit) return -limit;
+  if(v >  limit) return  limit;
+  return v;
+}
+
+// One frame of the candle simulation (updateCandle() of the firmware)
+void candle_update(candle_t *c) {
+  int16_t movx, movy;
+
+  // Random trigger brightness oscillation, if at least half uncalm
+  if(c->uncalm > (MAXUNCALM / 2)) {
+    if(candle_prng(c, 2000) < 5) c->uncalm = MAXUNCALM * 2;
+  }
+
+  // Random poke, intensity determined by uncalm value (0 is perfectly calm)
+  movx = (int16_t)(candle_prng(c, c->uncalm >> 8) - (c->uncalm >> 9));
+  movy = (int16_t)(candle_prng(c, c->uncalm >> 8) - (c->uncalm >> 9));
+
+  // Alternate between calm and uncalm periods
+  if(c->uncalm < MINUNCALM) c->uncalmdir =  UNCALMINC;
+  if(c->uncalm > MAXUNCALM) c->uncalmdir = -UNCALMINC;
+  c->uncalm += c->uncalmdir;
+
+  if(c->engine == ENGINE_IIR) {
+    // Filtered noise: y[n] = x[n] + a1 * y[n-1] - a2 * y[n-2]
+    int16_t limit = MAXDEV << c->iir->shift;
+    int16_t newx  = (int16_t)(movx + iir_apply(&c->iir->a1, c->centerx) - iir_apply(&c->iir->a2, c->xvel));
+    int16_t newy  = (int16_t)(movy + iir_apply(&c->iir->a1, c->centery) - iir_apply(&c->iir->a2, c->yvel));
+    c->xvel    = c->centerx;
+    c->yvel    = c->centery;
+    c->centerx = clamp(newx, limit);
+    c->centery = clamp(newy, limit);
+    c->ocra    = 128 + (c->centerx >> c->iir->shift);
+    c->ocrb    = 128 + (c->centery >> c->iir->shift);
+    return;
+  }
+
+  // Move center of flame by the current velocity
+  c->centerx = clamp((int16_t)(c->centerx + movx + (c->xvel >> 2)), MAXDEV);
+  c->centery = clamp((int16_t)(c->centery + movy + (c->yvel >> 2)), MAXDEV);
+
+  // Attenuate velocity 1/4 clicks (16-bit multiplication like on the AVR)
+  c->cnt++;
+  if(!(c->cnt & 3)) {
+    c->xvel = (int16_t)(c->xvel * 999) / 1000;
+    c->yvel = (int16_t)(c->yvel * 999) / 1000;
+  }
+
+  // Apply acceleration towards center (spring motion; hooke's law)
+  c->xvel = (int16_t)(c->xvel - c->centerx);
+  c->yvel = (int16_t)(c->yvel - c->centery);
+
+  // Set LEDs
+  c->ocra = 128 + c->centerx;
+  c->ocrb = 128 + c->centery;
+}
+
+// Start values of all flames
+void flames_init(candle_t *f, int n, uint8_t engine, uint16_t seed) {
+  int i;
+  for(i = 0; i < n; i++) candle_init(&f[i], engine, seed);
+}
+
+// Flames of one sub-frame, the LFSR state is passed on from flame to flame
+void flames_update(candle_t *f, int n, int subframes, int sub) {
+  int i;
+  for(i = sub; i < n; i += subframes) {
+    f[i].rn = f[0].rn;
+    candle_update(&f[i]);
+    f[0].rn = f[i].rn;
+  }
+}
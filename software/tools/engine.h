@@ -0,0 +1,84 @@
+// ===================================================================================
+// Project:   TinyCandle - Host Model of the Candle Simulation
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Bit-exact host implementation of updateCandle() and prng() of TinyCandle.ino. All
+// state lives in a structure, so any number of candles can be simulated at once.
+// The arithmetic reproduces the 16-bit int of avr-gcc, so the OCR0A/OCR0B sequence
+// is identical to the one of the firmware. Keep it in sync with the firmware!
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdint.h>
+#include "../config.h"            // CANDLEDELAY, LFSRSEED, LFSRTAPS, FLAMES of the firmware
+
+// Candle simulation parameters (same as firmware)
+#define MINUNCALM     ( 5 * 256)
+#define MAXUNCALM     (60 * 256)
+#define UNCALMINC     10
+#define MAXDEV        100
+
+// Flame engines
+#define ENGINE_SPRING 0           // spring/velocity integrator
+#define ENGINE_IIR    1           // shift-only IIR filtered noise
+
+// IIR filter coefficient as sum of signed powers of two
+#define IIR_MAXTERMS  4
+typedef struct {
+  uint8_t n;                      // number of terms
+  int8_t  sign[IIR_MAXTERMS];     // +1 or -1
+  int8_t  shift[IIR_MAXTERMS];    // right shift, -1 means left shift by one (2y)
+} iircoef_t;
+
+// IIR filter: y[n] = x[n] + a1 * y[n-1] - a2 * y[n-2], output = y[n] >> shift
+typedef struct {
+  iircoef_t a1;
+  iircoef_t a2;
+  uint8_t   shift;
+} iir_t;
+
+// Default filter of the firmware
+extern const iir_t iir_default;
+
+// Candle state
+typedef struct {
+  uint16_t rn;                    // LFSR state
+  uint16_t taps;                  // LFSR taps
+  int16_t  centerx;               // flame position (IIR: filter output y[n-1])
+  int16_t  centery;
+  int16_t  xvel;                  // flame velocity (IIR: filter output y[n-2])
+  int16_t  yvel;
+  uint16_t uncalm;
+  int16_t  uncalmdir;
+  uint8_t  cnt;
+  uint8_t  ocra;                  // PWM outputs
+  uint8_t  ocrb;
+  uint8_t  engine;
+  const iir_t *iir;
+} candle_t;
+
+// Initialize candle with firmware start values and given LFSR seed
+void     candle_init(candle_t *c, uint8_t engine, uint16_t seed);
+
+// Pseudo random number generator and one frame of the simulation
+uint16_t candle_prng(candle_t *c, uint16_t maxvalue);
+void     candle_update(candle_t *c);
+
+// Several flames of one MCU (FLAMES in config.h): all share the LFSR of the first one,
+// in sub-frame sub the flames sub, sub + subframes, ... are updated in this order
+void     flames_init(candle_t *f, int n, uint8_t engine, uint16_t seed);
+void     flames_update(candle_t *f, int n, int subframes, int sub);
+
+// Evaluate IIR coefficient on a 16-bit value like the firmware macro does
+int16_t  iir_apply(const iircoef_t *a, int16_t y);
+double   iir_value(const iircoef_t *a);
+
+#endif
@@ -0,0 +1,418 @@
+// ===================================================================================
+// Project:   TinyCandle - Flame Filter Designer
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Designs the second-order IIR filter of the filtered noise flame engine (ENGINE 1 in
+// TinyCandle.ino). The ATtiny13A has no hardware multiplier, so the coefficients are
+// restricted to sums of a few signed powers of two and are applied with shifts and
+// additions only. All representable coefficient pairs are searched exhaustively for
+// the one whose power spectrum best matches the target flicker spectrum on a
+// logarithmic scale. The target is either a resonance (frequency and bandwidth), a
+// spectrum from a CSV file or the spectrum fitted from a brightness recording.
+// The result is verified with the bit-exact host model of the firmware and printed
+// as #define lines to be pasted into TinyCandle.ino.
+//
+// Usage:
+// ------
+// flamedesign [options]
+//   -r HZ      frame rate of the firmware (default 63.1 for CANDLEDELAY 15 @ 1.2 MHz)
+//   -f HZ      target resonance frequency (default 4.0)
+//   -b HZ      target resonance bandwidth (default 1.5)
+//   -t FILE    target spectrum as CSV lines "frequency,power"
+//   -w FILE    brightness recording as CSV (first column), fit its spectrum
+//   -s HZ      sample rate of the recording (default frame rate)
+//   -k N       maximum number of power-of-two terms per coefficient (default 3)
+//   -a RMS     output RMS in PWM steps at full uncalm (default 35)
+//   -o FILE    write #define lines to FILE instead of stdout
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "engine.h"
+#include "spectrum.h"
+
+// Design settings
+#define NFREQ         48          // number of frequencies on the logarithmic grid
+#define FMIN          0.2         // lowest frequency of the grid in Hz
+#define MAXSHIFT      8           // largest right shift of a coefficient term
+#define MAXCAND       8192        // maximum number of coefficient candidates
+#define MAXREC        (1 << 22)   // maximum length of a recording
+#define VERIFYFRAMES  (1 << 18)   // frames simulated for verification
+#define VERIFYSEG     1024        // Welch segment length for verification
+#define MAXPOLE       0.995       // largest pole radius (fixed-point stability)
+
+// Target spectrum on the frequency grid
+static double freq[NFREQ], cosw[NFREQ], sinw[NFREQ], cos2w[NFREQ], sin2w[NFREQ];
+static double target[NFREQ];
+static int    nfreq;
+
+// Coefficient candidate
+typedef struct {
+  double    value;
+  int       cost;                 // instructions for shifts and additions (estimate)
+  iircoef_t coef;
+} cand_t;
+
+// ===================================================================================
+// Coefficient Candidates
+// ===================================================================================
+
+// AVR instructions for one term of a 16-bit coefficient (shift by k: 2 per bit)
+static int termcost(int shift) {
+  return (shift < 0 ? 2 : 2 * shift) + 2;
+}
+
+// Enumerate sums of up to maxterms signed powers of two within (lo, hi)
+static int enumerate(cand_t *list, double lo, double hi, int maxterms) {
+  int nshift = MAXSHIFT + 2, n = 0, mask, signs, i;
+  for(mask = 1; mask < (1 << nshift); mask++) {
+    int bits = __builtin_popcount(mask);
+    if(bits > maxterms) continue;
+    for(signs = 0; signs < (1 << bits); signs++) {
+      cand_t c;
+      int    t = 0, j;
+      memset(&c, 0, sizeof(c));
+      for(i = 0; i < nshift; i++) {
+        if(!(mask & (1 << i))) continue;
+        c.coef.shift[t] = i - 1;
+        c.coef.sign[t]  = (signs & (1 << t)) ? -1 : 1;
+        c.cost += termcost(i - 1);
+        t++;
+      }
+      c.coef.n = t;
+      c.value  = iir_value(&c.coef);
+      if(c.value <= lo || c.value >= hi) continue;
+
+      // Keep the cheapest representation of each value
+      for(j = 0; j < n && list[j].value != c.value; j++);
+      if(j < n) {
+        if(c.cost < list[j].cost) list[j] = c;
+      } else if(n < MAXCAND) list[n++] = c;
+    }
+  }
+  return n;
+}
+
+// ===================================================================================
+// Spectral Fit
+// ===================================================================================
+
+// Log power response of 1 / (1 - a1 z^-1 + a2 z^-2) on the grid
+static void response(double a1, double a2, double *logh) {
+  int k;
+  for(k = 0; k < nfreq; k++) {
+    double re = 1 - a1 * cosw[k] + a2 * cos2w[k];
+    double im = a1 * sinw[k] - a2 * sin2w[k];
+    logh[k] = -log10(re * re + im * im);
+  }
+}
+
+// Mean squared log error with optimal gain
+static double fiterror(double a1, double a2) {
+  double logh[NFREQ], mean = 0, err = 0;
+  int    k;
+  response(a1, a2, logh);
+  for(k = 0; k < nfreq; k++) mean += logh[k] - target[k];
+  mean /= nfreq;
+  for(k = 0; k < nfreq; k++) {
+    double d = logh[k] - target[k] - mean;
+    err += d * d;
+  }
+  return err / nfreq;
+}
+
+// Stable with margin for fixed-point arithmetic
+static int stable(double a1, double a2) {
+  return a2 < MAXPOLE * MAXPOLE && a1 < 1 + a2 && a1 > -(1 + a2);
+}
+
+// Noise power gain of the filter
+static double noisegain(double a1, double a2) {
+  double h1 = 0, h2 = 0, h = 1, sum = 0;
+  int    i;
+  for(i = 0; i < 65536; i++) {
+    sum += h * h;
+    h2 = h1;
+    h1 = h;
+    h  = a1 * h1 - a2 * h2;
+  }
+  return sum;
+}
+
+// ===================================================================================
+// Target Spectrum
+// ===================================================================================
+
+// Set up logarithmic frequency grid
+static void setgrid(double rate, double fmin, double fmax) {
+  int k;
+  nfreq = NFREQ;
+  for(k = 0; k < nfreq; k++) {
+    double w;
+    freq[k]  = fmin * pow(fmax / fmin, (double)k / (nfreq - 1));
+    w        = 2 * M_PI * freq[k] / rate;
+    cosw[k]  = cos(w);
+    sinw[k]  = sin(w);
+    cos2w[k] = cos(2 * w);
+    sin2w[k] = sin(2 * w);
+  }
+}
+
+// Resonance: continuous second-order system with given frequency and bandwidth
+static void target_resonance(double f0, double bw) {
+  int k;
+  for(k = 0; k < nfreq; k++) {
+    double a = f0 * f0 - freq[k] * freq[k];
+    target[k] = -log10(a * a + freq[k] * freq[k] * bw * bw);
+  }
+}
+
+// Spectrum from CSV file, log-log interpolation
+static int target_csv(const char *filename) {
+  static double f[4096], p[4096];
+  char   line[256];
+  int    n = 0, k, i;
+  FILE  *fp = fopen(filename, "r");
+  if(!fp) return -1;
+  while(n < 4096 && fgets(line, sizeof(line), fp))
+    if(sscanf(line, "%lf%*[ ,;\t]%lf", &f[n], &p[n]) == 2 && f[n] > 0 && p[n] > 0) n++;
+  fclose(fp);
+  if(n < 2) return -1;
+  for(k = 0; k < nfreq; k++) {
+    double x = log10(freq[k]);
+    for(i = 0; i < n - 2 && freq[k] > f[i + 1]; i++);
+    target[k] = log10(p[i]) + (log10(p[i + 1]) - log10(p[i])) * (x - log10(f[i])) / (log10(f[i + 1]) - log10(f[i]));
+  }
+  return 0;
+}
+
+// Spectrum of a brightness recording, returns Welch PSD and its segment length
+static double *psd_recording(const char *filename, int *seg) {
+  double *x = malloc(MAXREC * sizeof(double));
+  double *psd;
+  char    line[256];
+  size_t  len = 0;
+  FILE   *fp = fopen(filename, "r");
+  if(!fp || !x) {
+    free(x);
+    return NULL;
+  }
+  while(len < MAXREC && fgets(line, sizeof(line), fp))
+    if(sscanf(line, "%lf", &x[len]) == 1) len++;
+  fclose(fp);
+  for(*seg = 4096; *seg > 64 && (size_t)*seg * 4 > len; *seg >>= 1);
+  if(len < (size_t)*seg * 2) {
+    free(x);
+    return NULL;
+  }
+  psd = malloc((*seg / 2 + 1) * sizeof(double));
+  psd_welch(x, len, *seg, psd);
+  free(x);
+  return psd;
+}
+
+// ===================================================================================
+// Output
+// ===================================================================================
+
+// Write coefficient as C macro of shifts and additions
+static void emit(FILE *f, const char *name, const iircoef_t *a) {
+  int  i, pass, first = 1;
+  char def[32];
+  snprintf(def, sizeof(def), "%s(y)", name);
+  fprintf(f, "#define %-13s (", def);
+  for(pass = 1; pass >= -1; pass -= 2) {
+    for(i = 0; i < a->n; i++) {
+      if(a->sign[i] != pass) continue;
+      if(first) fprintf(f, pass > 0 ? "" : "-");
+      else      fprintf(f, pass > 0 ? " + " : " - ");
+      if(a->shift[i] < 0)       fprintf(f, pass > 0 ? "(y) + (y)" : "(y) - (y)");
+      else if(!a->shift[i])     fprintf(f, "(y)");
+      else                      fprintf(f, "((y) >> %d)", a->shift[i]);
+      first = 0;
+    }
+  }
+  fprintf(f, ")\n");
+}
+
+// Print usage
+static void usage(void) {
+  fprintf(stderr,
+    "Usage: flamedesign [options]\n"
+    "  -r HZ      frame rate of the firmware (default 63.1)\n"
+    "  -f HZ      target resonance frequency (default 4.0)\n"
+    "  -b HZ      target resonance bandwidth (default 1.5)\n"
+    "  -t FILE    target spectrum as CSV lines \"frequency,power\"\n"
+    "  -w FILE    brightness recording as CSV (first column), fit its spectrum\n"
+    "  -s HZ      sample rate of the recording (default frame rate)\n"
+    "  -k N       maximum number of power-of-two terms per coefficient (default 3)\n"
+    "  -a RMS     output RMS in PWM steps at full uncalm (default 35)\n"
+    "  -o FILE    write #define lines to FILE instead of stdout\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static cand_t c1[MAXCAND], c2[MAXCAND];
+  static double trace[VERIFYFRAMES], psd[VERIFYSEG / 2 + 1];
+  double rate = 63.1, f0 = 4.0, bw = 1.5, srate = 0, rms = 35;
+  double fmin = FMIN, fmax, best = 1e30, ideal = 1e30, a1i = 0, a2i = 0;
+  double sigmax, sigmay, gain, clip = 0, sum = 0, sum2 = 0, mean;
+  double achieved[NFREQ], tpeak = 0, apeak = 0;
+  char  *csvfile = NULL, *recfile = NULL, *outfile = NULL;
+  int    maxterms = 3, n1, n2, i, j, opt, shift, bound, bi = -1, bj = -1, k;
+  iir_t  iir;
+  candle_t cdl;
+  FILE  *out = stdout;
+
+  // Parse command line
+  while((opt = getopt(argc, argv, "r:f:b:t:w:s:k:a:o:h")) != -1) {
+    switch(opt) {
+      case 'r': rate     = atof(optarg); break;
+      case 'f': f0       = atof(optarg); break;
+      case 'b': bw       = atof(optarg); break;
+      case 't': csvfile  = optarg; break;
+      case 'w': recfile  = optarg; break;
+      case 's': srate    = atof(optarg); break;
+      case 'k': maxterms = atoi(optarg); break;
+      case 'a': rms      = atof(optarg); break;
+      case 'o': outfile  = optarg; break;
+      default:  usage();
+    }
+  }
+  if(optind != argc || rate <= 0 || maxterms < 1 || maxterms > IIR_MAXTERMS) usage();
+  if(!srate) srate = rate;
+  fmax = 0.45 * rate;
+
+  // Target spectrum
+  if(recfile) {
+    int     seg;
+    double *rec = psd_recording(recfile, &seg);
+    if(!rec) {
+      fprintf(stderr, "Error: cannot read recording %s\n", recfile);
+      return 1;
+    }
+    if(fmin < 2 * srate / seg) fmin = 2 * srate / seg;
+    if(fmax > 0.45 * srate)    fmax = 0.45 * srate;
+    setgrid(rate, fmin, fmax);
+    for(k = 0; k < nfreq; k++) target[k] = log10(psd_at(rec, seg, srate, freq[k]) + 1e-12);
+    free(rec);
+  } else {
+    setgrid(rate, fmin, fmax);
+    if(csvfile) {
+      if(target_csv(csvfile)) {
+        fprintf(stderr, "Error: cannot read target spectrum %s\n", csvfile);
+        return 1;
+      }
+    } else target_resonance(f0, bw);
+  }
+
+  // Unconstrained optimum on a fine grid (reference for the quantization loss), a1 < 0
+  // for resonances above a quarter of the frame rate
+  for(i = -2047; i < 2048; i++) {
+    for(j = 1; j < 1024; j++) {
+      double a1 = i / 1024.0, a2 = j / 1024.0, e;
+      if(!stable(a1, a2)) continue;
+      e = fiterror(a1, a2);
+      if(e < ideal) {
+        ideal = e;
+        a1i   = a1;
+        a2i   = a2;
+      }
+    }
+  }
+
+  // Exhaustive search over power-of-two coefficients
+  n1 = enumerate(c1, -2, 2, maxterms);
+  n2 = enumerate(c2, 0, 1, maxterms);
+  for(i = 0; i < n1; i++) {
+    for(j = 0; j < n2; j++) {
+      double e;
+      if(!stable(c1[i].value, c2[j].value)) continue;
+      e = fiterror(c1[i].value, c2[j].value) * (1 + 0.001 * (c1[i].cost + c2[j].cost));
+      if(e < best) {
+        best = e;
+        bi   = i;
+        bj   = j;
+      }
+    }
+  }
+  if(bi < 0) {
+    fprintf(stderr, "Error: no stable filter found\n");
+    return 1;
+  }
+  iir.a1 = c1[bi].coef;
+  iir.a2 = c2[bj].coef;
+
+  // Output scaling: uniform noise of full uncalm through the filter
+  sigmax = sqrt(((MAXUNCALM >> 8) * (MAXUNCALM >> 8) - 1) / 12.0);
+  sigmay = sigmax * sqrt(noisegain(c1[bi].value, c2[bj].value));
+  shift  = (int)lround(log2(sigmay / rms));
+  bound  = 1;
+  for(k = 0; k < iir.a1.n; k++) bound += (iir.a1.shift[k] < 0) ? 2 : 1;
+  for(k = 0; k < iir.a2.n; k++) bound += (iir.a2.shift[k] < 0) ? 2 : 1;
+  if(shift < 0) shift = 0;
+  while(shift > 0 && (MAXDEV << shift) * bound + 2 * (MAXUNCALM >> 8) > 32767) shift--;
+  iir.shift = shift;
+  gain = pow(2, shift);
+
+  // Verify with the host model of the firmware
+  candle_init(&cdl, ENGINE_IIR, 0);
+  cdl.iir = &iir;
+  for(i = 0; i < VERIFYFRAMES; i++) {
+    candle_update(&cdl);
+    trace[i] = cdl.ocra;
+    sum  += cdl.ocra;
+    sum2 += (double)cdl.ocra * cdl.ocra;
+    if(cdl.ocra == 128 - MAXDEV || cdl.ocra == 128 + MAXDEV) clip++;
+  }
+  mean = sum / VERIFYFRAMES;
+  psd_welch(trace, VERIFYFRAMES, VERIFYSEG, psd);
+
+  // Report
+  fprintf(stderr, "Target:      ");
+  if(recfile)      fprintf(stderr, "recording %s @ %.2f Hz\n", recfile, srate);
+  else if(csvfile) fprintf(stderr, "spectrum %s\n", csvfile);
+  else             fprintf(stderr, "resonance %.2f Hz, bandwidth %.2f Hz\n", f0, bw);
+  fprintf(stderr, "Grid:        %.2f - %.2f Hz @ %.2f frames/s\n", fmin, fmax, rate);
+  fprintf(stderr, "Candidates:  %d x %d (up to %d terms)\n", n1, n2, maxterms);
+  fprintf(stderr, "a1:          %.6f (unconstrained %.6f)\n", c1[bi].value, a1i);
+  fprintf(stderr, "a2:          %.6f (unconstrained %.6f)\n", c2[bj].value, a2i);
+  fprintf(stderr, "Poles:       r = %.4f at %.2f Hz\n", sqrt(c2[bj].value),
+          acos(c1[bi].value / (2 * sqrt(c2[bj].value))) * rate / (2 * M_PI));
+  fprintf(stderr, "Fit error:   %.4f (unconstrained %.4f) decades^2\n", fiterror(c1[bi].value, c2[bj].value), ideal);
+  fprintf(stderr, "Cost:        ~%d instructions per axis\n", c1[bi].cost + c2[bj].cost);
+  fprintf(stderr, "Output:      shift %d, RMS %.1f (requested %.1f), clipped %.2f%%\n",
+          shift, sqrt(sum2 / VERIFYFRAMES - mean * mean), rms, clip * 100 / VERIFYFRAMES);
+  if(sigmay / gain < rms / 2) fprintf(stderr, "Warning:     output RMS limited by 16-bit headroom\n");
+
+  // Spectra relative to their peaks
+  for(k = 0; k < nfreq; k++) {
+    achieved[k] = log10(psd_at(psd, VERIFYSEG, rate, freq[k]) + 1e-12);
+    if(!k || target[k]   > tpeak) tpeak = target[k];
+    if(!k || achieved[k] > apeak) apeak = achieved[k];
+  }
+  fprintf(stderr, "\n  f [Hz]   target [dB]  achieved [dB]\n");
+  for(k = 0; k < nfreq; k += 4)
+    fprintf(stderr, "%8.2f  %11.1f  %13.1f\n", freq[k], 10 * (target[k] - tpeak), 10 * (achieved[k] - apeak));
+
+  // Constants for the firmware
+  if(outfile && !(out = fopen(outfile, "w"))) {
+    fprintf(stderr, "Error: cannot open %s\n", outfile);
+    return 1;
+  }
+  fprintf(out, "// Filter coefficients (flamedesign: a1 = %.6f, a2 = %.6f)\n", c1[bi].value, c2[bj].value);
+  emit(out, "IIR_A1", &iir.a1);
+  emit(out, "IIR_A2", &iir.a2);
+  fprintf(out, "#define IIR_SHIFT     %d\n", iir.shift);
+  if(out != stdout) fclose(out);
+  return 0;
+}
@@ -0,0 +1,359 @@
+// ===================================================================================
+// Project:   TinyCandle - Flame Runner for Linux PWM and LED Devices
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Runs the bit-exact host engine on a Linux board and shows the flame on PWM channels
+// (/sys/class/pwm) or LEDs (/sys/class/leds). Every two channels are one candle (the
+// OCR0A and OCR0B outputs of the firmware); several candles share one LFSR like the
+// flames of one MCU (FLAMES in config.h). The frames are paced by a periodic timerfd
+// with absolute expiry times, so the frame rate does not drift with the time spent
+// per frame. Missed frames are caught up in the engine and only the latest values
+// are written.
+//
+// All attribute files are opened once at start. Per frame, only the channels whose
+// value changed are formatted and written with one pwrite() each (no seek, no open),
+// so a frame costs one read() of the timer plus one write per changed channel. The
+// wake-up latency (time between the frame deadline and the return of the timer read)
+// and the time spent writing are measured every frame; mean, jitter (standard
+// deviation), percentiles and maximum are printed at the end (-n frames, -t seconds or
+// Ctrl-C), optionally also the latency of every frame.
+//
+// The sysfs root can be moved with -r, which allows a test against a fake directory
+// tree with plain files (values are then written with a fixed width, since a plain
+// file is not truncated by a write).
+//
+// Channels:
+// ---------
+//   pwm/pwmchip0/pwm0   PWM channel, exported if needed, the duty cycle is OCR/255
+//                       of the period (-p)
+//   leds/NAME           LED, the brightness is OCR/255 of max_brightness
+//
+// Usage:
+// ------
+// flamerun [options] CHANNEL...
+//   -r DIR     sysfs root (default /sys)
+//   -f FPS     frame rate (default 63.1, firmware as shipped)
+//   -p NS      PWM period in nanoseconds (default 1000000)
+//   -e E       engine (default ENGINE of config.h)
+//   -s SEED    LFSR seed (default LFSRSEED of config.h)
+//   -n N       stop after N frames
+//   -t SEC     stop after SEC seconds
+//   -l FILE    write latency and write time of every frame as CSV
+//   -R PRIO    real-time priority (SCHED_FIFO) and locked memory
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include "engine.h"
+
+// Runner settings
+#define DEFAULTFPS    63.1
+#define DEFAULTPERIOD 1000000     // PWM period in ns (1 kHz)
+#define MAXCHANNELS   64
+#define FAKEWIDTH     10          // value width in fake sysfs files
+#define HISTBINS      10000       // latency histogram: 1 us bins up to 10 ms
+
+// Output channel
+typedef struct {
+  int      fd;                    // duty_cycle or brightness
+  int      pwm;                   // PWM channel, else LED
+  int      fake;                  // plain file instead of sysfs attribute
+  uint32_t scale;                 // period or max_brightness
+  int      value;                 // last written OCR value, -1 if none
+  char     path[256];
+} channel_t;
+
+// Online statistics of a time in nanoseconds
+typedef struct {
+  uint64_t n;
+  double   mean, m2;              // Welford
+  int64_t  max;
+  uint32_t hist[HISTBINS + 1];    // last bin counts everything above
+} timing_t;
+
+static channel_t         channels[MAXCHANNELS];
+static int               nchannels;
+static volatile sig_atomic_t stop;
+
+// ===================================================================================
+// Sysfs
+// ===================================================================================
+
+// Write string to attribute file, returns 0 on success
+static int writeattr(const char *path, const char *value) {
+  int     fd = open(path, O_WRONLY);
+  ssize_t n;
+  if(fd < 0) return -1;
+  n = write(fd, value, strlen(value));
+  close(fd);
+  return n == (ssize_t)strlen(value) ? 0 : -1;
+}
+
+// Read number from attribute file, returns -1 on error
+static long readattr(const char *path) {
+  char buf[32];
+  int  fd = open(path, O_RDONLY);
+  long n;
+  if(fd < 0) return -1;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if(n <= 0) return -1;
+  buf[n] = 0;
+  return strtol(buf, NULL, 0);
+}
+
+// Open channel "pwm/pwmchipN/pwmM" or "leds/NAME" below root, returns 0 on success
+static int openchannel(channel_t *c, const char *root, const char *name, uint32_t period) {
+  char        path[512], chip[256], num[16];
+  const char *p;
+  struct stat st;
+
+  memset(c, 0, sizeof(*c));
+  c->value = -1;
+  snprintf(c->path, sizeof(c->path), "%s/class/%s", root, name);
+  if(!strncmp(name, "pwm/", 4)) {
+    c->pwm = 1;
+    // Export channel of the chip if needed
+    if(stat(c->path, &st) && (p = strrchr(c->path, '/')) && !strncmp(p + 1, "pwm", 3)) {
+      snprintf(chip, sizeof(chip), "%.*s/export", (int)(p - c->path), c->path);
+      snprintf(num, sizeof(num), "%s", p + 4);
+      writeattr(chip, num);
+    }
+    snprintf(path, sizeof(path), "%s/duty_cycle", c->path);
+    if(writeattr(path, "0")) return -1;
+    snprintf(path, sizeof(path), "%s/period", c->path);
+    snprintf(num, sizeof(num), "%u", period);
+    if(writeattr(path, num)) return -1;
+    snprintf(path, sizeof(path), "%s/enable", c->path);
+    if(writeattr(path, "1")) return -1;
+    c->scale = period;
+    snprintf(path, sizeof(path), "%s/duty_cycle", c->path);
+  } else if(!strncmp(name, "leds/", 5)) {
+    long max;
+    snprintf(path, sizeof(path), "%s/max_brightness", c->path);
+    if((max = readattr(path)) <= 0) return -1;
+    c->scale = max;
+    snprintf(path, sizeof(path), "%s/brightness", c->path);
+  } else return -1;
+  if((c->fd = open(path, O_WRONLY)) < 0 || fstat(c->fd, &st)) return -1;
+  c->fake = S_ISREG(st.st_mode);
+  return 0;
+}
+
+// Format value of channel into buf, returns length
+static int format(const channel_t *c, uint8_t ocr, char *buf) {
+  unsigned long v = (unsigned long)c->scale * ocr / 255;
+  return c->fake ? sprintf(buf, "%0*lu\n", FAKEWIDTH, v) : sprintf(buf, "%lu\n", v);
+}
+
+// ===================================================================================
+// Timing
+// ===================================================================================
+
+static int64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void timing_add(timing_t *t, int64_t ns) {
+  double d = ns - t->mean;
+  t->n++;
+  t->mean += d / t->n;
+  t->m2   += d * (ns - t->mean);
+  if(ns > t->max) t->max = ns;
+  t->hist[ns < 0 ? 0 : ns / 1000 < HISTBINS ? ns / 1000 : HISTBINS]++;
+}
+
+// Percentile in microseconds (upper edge of the bin)
+static double timing_pct(const timing_t *t, double pct) {
+  uint64_t sum = 0, target = (uint64_t)ceil(pct / 100 * t->n);
+  int      i;
+  for(i = 0; i <= HISTBINS; i++) {
+    sum += t->hist[i];
+    if(sum >= target && sum) return i + 1;
+  }
+  return HISTBINS;
+}
+
+static void timing_print(const char *name, const timing_t *t) {
+  if(!t->n) return;
+  printf("%-12s mean %.1f us, jitter %.1f us, p50 %.0f us, p99 %.0f us, p99.9 %.0f us, max %.1f us\n",
+         name, t->mean / 1000, sqrt(t->n > 1 ? t->m2 / (t->n - 1) : 0) / 1000,
+         timing_pct(t, 50), timing_pct(t, 99), timing_pct(t, 99.9), t->max / 1000.0);
+}
+
+static void onsignal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+// ===================================================================================
+// Main
+// ===================================================================================
+
+// Print usage
+static void usage(void) {
+  fprintf(stderr,
+    "Usage: flamerun [options] CHANNEL...\n"
+    "  CHANNEL    pwm/pwmchipN/pwmM or leds/NAME, two channels per candle\n"
+    "  -r DIR     sysfs root (default /sys)\n"
+    "  -f FPS     frame rate (default %.1f, firmware as shipped)\n"
+    "  -p NS      PWM period in nanoseconds (default %d)\n"
+    "  -e E       engine (default %d)\n"
+    "  -s SEED    LFSR seed (default 0x%04X)\n"
+    "  -n N       stop after N frames\n"
+    "  -t SEC     stop after SEC seconds\n"
+    "  -l FILE    write latency and write time of every frame as CSV\n"
+    "  -R PRIO    real-time priority (SCHED_FIFO) and locked memory\n",
+    DEFAULTFPS, DEFAULTPERIOD, ENGINE, LFSRSEED);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static timing_t   latency, writing;
+  static candle_t   candles[MAXCHANNELS / 2];
+  const char       *root = "/sys", *logfile = NULL;
+  double            fps = DEFAULTFPS, seconds = 0;
+  uint32_t          period = DEFAULTPERIOD;
+  uint64_t          frames = 0, frame = 0, missed = 0, writes = 0, expired;
+  uint16_t          seed = 0;
+  int               engine = ENGINE, prio = 0, ncandles, opt, i, tfd;
+  int64_t           start, step, deadline, t, w;
+  struct itimerspec its;
+  struct sigaction  sa;
+  FILE             *log = NULL;
+  char              buf[32];
+  int               len;
+
+  // Parse command line
+  while((opt = getopt(argc, argv, "r:f:p:e:s:n:t:l:R:h")) != -1) {
+    switch(opt) {
+      case 'r': root    = optarg; break;
+      case 'f': fps     = atof(optarg); break;
+      case 'p': period  = strtoul(optarg, NULL, 0); break;
+      case 'e': engine  = atoi(optarg) ? ENGINE_IIR : ENGINE_SPRING; break;
+      case 's': seed    = strtoul(optarg, NULL, 0); break;
+      case 'n': frames  = strtoull(optarg, NULL, 0); break;
+      case 't': seconds = atof(optarg); break;
+      case 'l': logfile = optarg; break;
+      case 'R': prio    = atoi(optarg); break;
+      default:  usage();
+    }
+  }
+  if(optind >= argc || argc - optind > MAXCHANNELS || fps <= 0 || !period) usage();
+  if(seconds > 0 && (!frames || frames > seconds * fps)) frames = (uint64_t)(seconds * fps);
+
+  // Open channels and start candles
+  for(i = optind; i < argc; i++, nchannels++) {
+    if(openchannel(&channels[nchannels], root, argv[i], period)) {
+      fprintf(stderr, "Error: cannot open channel %s/class/%s (%s)\n", root, argv[i], strerror(errno));
+      return 1;
+    }
+  }
+  ncandles = (nchannels + 1) / 2;
+  flames_init(candles, ncandles, engine, seed);
+  if(logfile) {
+    if(!(log = fopen(logfile, "w"))) {
+      fprintf(stderr, "Error: cannot write %s\n", logfile);
+      return 1;
+    }
+    fprintf(log, "frame,latency_ns,write_ns,missed\n");
+  }
+
+  // Real-time scheduling
+  if(prio) {
+    struct sched_param sp = {.sched_priority = prio};
+    if(sched_setscheduler(0, SCHED_FIFO, &sp) || mlockall(MCL_CURRENT | MCL_FUTURE))
+      fprintf(stderr, "Warning: real-time priority not available (%s)\n", strerror(errno));
+  }
+
+  // Stop on Ctrl-C, the timer read is interrupted
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onsignal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  // Periodic timer with absolute expiry times
+  step  = (int64_t)(1e9 / fps);
+  start = now() + step;
+  if((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) {
+    fprintf(stderr, "Error: cannot create timer (%s)\n", strerror(errno));
+    return 1;
+  }
+  its.it_value.tv_sec     = start / 1000000000;
+  its.it_value.tv_nsec    = start % 1000000000;
+  its.it_interval.tv_sec  = step / 1000000000;
+  its.it_interval.tv_nsec = step % 1000000000;
+  if(timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL)) {
+    fprintf(stderr, "Error: cannot start timer (%s)\n", strerror(errno));
+    return 1;
+  }
+
+  printf("Running %d candle%s on %d channel%s at %.1f fps ...\n", ncandles, ncandles > 1 ? "s" : "",
+         nchannels, nchannels > 1 ? "s" : "", fps);
+  while(!stop && (!frames || frame < frames)) {
+    if(read(tfd, &expired, sizeof(expired)) != sizeof(expired)) {
+      if(errno == EINTR) continue;
+      break;
+    }
+    t = now();
+    frame   += expired;
+    deadline = start + (int64_t)(frame - 1) * step;
+    missed  += expired - 1;
+
+    // Engine steps of all frames since the last wake-up, output of the last one
+    while(expired--) flames_update(candles, ncandles, 1, 0);
+    for(i = 0; i < nchannels; i++) {
+      const candle_t *c   = &candles[i / 2];
+      uint8_t         ocr = (i & 1) ? c->ocrb : c->ocra;
+      if(ocr == channels[i].value) continue;
+      len = format(&channels[i], ocr, buf);
+      if(pwrite(channels[i].fd, buf, len, 0) != len) {
+        fprintf(stderr, "Error: cannot write %s (%s)\n", channels[i].path, strerror(errno));
+        stop = 1;
+      }
+      channels[i].value = ocr;
+      writes++;
+    }
+    w = now();
+    timing_add(&latency, t - deadline);
+    timing_add(&writing, w - t);
+    if(log) fprintf(log, "%llu,%lld,%lld,%llu\n", (unsigned long long)frame, (long long)(t - deadline),
+                    (long long)(w - t), (unsigned long long)missed);
+  }
+
+  // Switch off
+  for(i = 0; i < nchannels; i++) {
+    len = format(&channels[i], 0, buf);
+    if(pwrite(channels[i].fd, buf, len, 0) != len)
+      fprintf(stderr, "Warning: cannot switch off %s\n", channels[i].path);
+    close(channels[i].fd);
+  }
+  close(tfd);
+  if(log) fclose(log);
+
+  // Summary
+  printf("Frames:      %llu, %llu missed, %.2f writes per frame\n", (unsigned long long)frame,
+         (unsigned long long)missed, latency.n ? (double)writes / latency.n : 0);
+  timing_print("Latency:", &latency);
+  timing_print("Write:", &writing);
+  return 0;
+}
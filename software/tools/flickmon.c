@@ -0,0 +1,332 @@
+// ===================================================================================
+// Project:   TinyCandle - Streaming Flicker Quality Monitor
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Watches the OCR0A/OCR0B frames of many candles as they arrive on a pipe or in a file
+// and reports every candle which departs from its baseline profile or whose output is
+// stuck (see monitor.h for the statistics). The state per candle is constant (about
+// 400 bytes), each frame is processed once and never stored, so the monitor runs on
+// endless live streams and keeps up with thousands of candles per core. Alerts are
+// printed as they occur, a summary of all candles with alerts is printed at the end of
+// the stream or on Ctrl-C.
+//
+// Streams:
+// --------
+//   trace      trace file (tinysim -r, traceq -g), one candle, detected by its header
+//   raw        4 bytes per frame: candle number (16 bit, little endian), OCR0A, OCR0B
+//   text       one line per frame: candle OCR0A OCR0B
+//
+// Usage:
+// ------
+// flickmon [options] [FILE]      (stream from stdin without FILE)
+//   -f FMT     stream format raw or text (default raw, trace detected)
+//   -n N       number of candles (default 4096)
+//   -r FPS     frame rate (default 63.1 or from the trace header)
+//   -b N       frames per block, multiple of 256 (default 4096)
+//   -l N       blocks to learn the baseline (default 8)
+//   -z Z       departure threshold in spreads (default 6)
+//   -k N       departed blocks in a row for an alert (default 2)
+//   -s SEC     time without change for a stuck output (default 5)
+//   -p FILE    reference profile for all candles (no learning)
+//   -w FILE    write learned profile (average of all candles) at the end
+//   -v         also report learned baselines
+//   -q         alerts only, no summary
+
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "monitor.h"
+#include "trace.h"
+
+// Monitor settings
+#define MAXCANDLES    65536
+#define DEFAULTFPS    63.1        // frame rate of the firmware as shipped
+#define BUFSIZE       (1 << 16)   // bytes per read
+#define MAXLIST       50          // candles in the summary
+
+enum {FMT_RAW, FMT_TEXT, FMT_TRACE};
+
+static monitor_config_t  config;
+static monitor_t        *candles;
+static int               ncandles, verbose;
+static uint64_t          frames, ignored;
+static volatile sig_atomic_t stop;
+
+static void onsignal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+// Read what has arrived (up to len bytes) without waiting for a full buffer, so
+// alerts of a live stream are not delayed. Interrupted reads are retried unless
+// stopped. Returns the bytes read, 0 at the end and -1 on error.
+static ssize_t readsome(int fd, uint8_t *buf, size_t len) {
+  ssize_t n;
+  while((n = read(fd, buf, len)) < 0 && errno == EINTR && !stop);
+  return n;
+}
+
+// Process frame of a candle and print its alerts
+static void frame(unsigned id, uint8_t ocra, uint8_t ocrb) {
+  monitor_t *m;
+  double     t;
+  int        ev, ch, i;
+
+  if(id >= (unsigned)ncandles) {
+    ignored++;
+    return;
+  }
+  m = &candles[id];
+  frames++;
+  if(!(ev = monitor_frame(m, &config, ocra, ocrb) & ~MON_BLOCK)) return;
+  t = m->frames / config.fps;
+  if(ev & MON_STUCK) {
+    for(ch = 0; ch < 2; ch++) {
+      if(m->run[ch] != config.stuck) continue;
+      printf("%9.1f s  candle %-5u stuck: OCR0%c at %u for %.1f s\n",
+             t, id, 'A' + ch, m->last[ch], config.stuck / config.fps);
+    }
+  }
+  if(ev & MON_DEPART) {
+    i = m->worst;
+    printf("%9.1f s  candle %-5u departed: %s %.4g (baseline %.4g +- %.3g, z %.1f)\n",
+           t, id, monitor_metric(i), m->metric[i], m->base.mean[i], m->base.spread[i], m->zworst);
+  }
+  if((ev & MON_LEARNED) && verbose)
+    printf("%9.1f s  candle %-5u baseline: mean %.1f/%.1f, std %.1f/%.1f, clip %.3f%%\n",
+           t, id, m->base.mean[MON_MEAN(0)], m->base.mean[MON_MEAN(1)],
+           m->base.mean[MON_STD(0)], m->base.mean[MON_STD(1)], 100 * m->base.mean[MON_CLIP]);
+}
+
+// Process raw or trace bytes, returns bytes consumed
+static size_t parse_binary(const uint8_t *p, size_t n, int fmt) {
+  size_t i = 0;
+  if(fmt == FMT_TRACE) {
+    for(; i + 2 <= n; i += 2) frame(0, p[i], p[i + 1]);
+  }
+  else {
+    for(; i + 4 <= n; i += 4) frame(p[i] | p[i + 1] << 8, p[i + 2], p[i + 3]);
+  }
+  return i;
+}
+
+// Process text lines, returns bytes consumed
+static size_t parse_text(const uint8_t *p, size_t n) {
+  const uint8_t *start = p, *end = p + n, *nl;
+  unsigned       id, a, b;
+  char           line[64];
+
+  while((nl = memchr(p, '\n', end - p))) {
+    size_t len = nl - p < (long)sizeof(line) - 1 ? (size_t)(nl - p) : sizeof(line) - 1;
+    memcpy(line, p, len);
+    line[len] = 0;
+    if(sscanf(line, "%u %u %u", &id, &a, &b) == 3 && a < 256 && b < 256) frame(id, a, b);
+    p = nl + 1;
+  }
+  return p - start;
+}
+
+// Average profile of all candles with a learned baseline, returns number of candles
+static int average(monitor_profile_t *p) {
+  int i, k, n = 0;
+  memset(p, 0, sizeof(*p));
+  for(i = 0; i < ncandles; i++) {
+    if(!candles[i].frames || candles[i].blocks < config.learn) continue;
+    for(k = 0; k < MON_METRICS; k++) {
+      p->mean[k]   += candles[i].base.mean[k];
+      p->spread[k] += candles[i].base.spread[k];
+    }
+    n++;
+  }
+  for(k = 0; n && k < MON_METRICS; k++) {
+    p->mean[k]   /= n;
+    p->spread[k] /= n;
+  }
+  return n;
+}
+
+// Sort candles by alerts
+static int cmpalerts(const void *a, const void *b) {
+  uint32_t x = candles[*(const int *)a].alerts, y = candles[*(const int *)b].alerts;
+  return (y > x) - (y < x);
+}
+
+// Summary of the stream and of the candles with alerts
+static void summary(double seconds) {
+  int    *list = malloc(ncandles * sizeof(int));
+  int     i, n = 0, seen = 0;
+  double  hours;
+
+  for(i = 0; i < ncandles; i++) {
+    if(!candles[i].frames) continue;
+    seen++;
+    if(candles[i].alerts && list) list[n++] = i;
+  }
+  printf("\nFrames:  %llu of %d candle%s", (unsigned long long)frames, seen, seen == 1 ? "" : "s");
+  if(ignored) printf(", %llu ignored (candle >= %d)", (unsigned long long)ignored, ncandles);
+  printf("\nSpeed:   %.0f frames/s (%.0f candles at %.1f fps)\n",
+         seconds > 0 ? frames / seconds : 0, seconds > 0 ? frames / seconds / config.fps : 0, config.fps);
+  printf("Alerts:  %d candle%s\n", n, n == 1 ? "" : "s");
+  if(!n) {
+    free(list);
+    return;
+  }
+  qsort(list, n, sizeof(int), cmpalerts);
+  printf("\ncandle    minutes   meanA   meanB    stdA    stdB   clip%%  gusts/h  alerts\n");
+  for(i = 0; i < n && i < MAXLIST; i++) {
+    monitor_t *m = &candles[list[i]];
+    hours = m->frames / config.fps / 3600;
+
+    // Last completed block, or the running block of a candle without one
+    if(m->frames < config.block)
+      printf("%-7d %9.1f %7.1f %7.1f %7.1f %7.1f", list[i], hours * 60, m->mean[0], m->mean[1],
+             sqrt(m->m2[0] / m->n), sqrt(m->m2[1] / m->n));
+    else
+      printf("%-7d %9.1f %7.1f %7.1f %7.1f %7.1f", list[i], hours * 60, m->metric[MON_MEAN(0)],
+             m->metric[MON_MEAN(1)], m->metric[MON_STD(0)], m->metric[MON_STD(1)]);
+    printf(" %7.3f %8.1f %7u\n", 100.0 * m->totalclips / m->frames, m->totalgusts / hours, m->alerts);
+  }
+  if(n > MAXLIST) printf("... %d more\n", n - MAXLIST);
+  free(list);
+}
+
+// Print usage
+static void usage(void) {
+  fprintf(stderr,
+    "Usage: flickmon [options] [FILE]\n"
+    "  FILE       stream file (default stdin)\n"
+    "  -f FMT     stream format raw or text (default raw, trace detected)\n"
+    "  -n N       number of candles (default 4096)\n"
+    "  -r FPS     frame rate (default %.1f or from the trace header)\n"
+    "  -b N       frames per block, multiple of 256 (default 4096)\n"
+    "  -l N       blocks to learn the baseline (default 8)\n"
+    "  -z Z       departure threshold in spreads (default 6)\n"
+    "  -k N       departed blocks in a row for an alert (default 2)\n"
+    "  -s SEC     time without change for a stuck output (default 5)\n"
+    "  -p FILE    reference profile for all candles (no learning)\n"
+    "  -w FILE    write learned profile (average of all candles) at the end\n"
+    "  -v         also report learned baselines\n"
+    "  -q         alerts only, no summary\n",
+    DEFAULTFPS);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static uint8_t     buf[BUFSIZE];
+  const char        *proffile = NULL, *outfile = NULL;
+  monitor_profile_t  ref, avg;
+  trace_header_t     hdr;
+  double             fps = 0, z = 0, stuck = 0;
+  uint32_t           block = 0, learn = 0, persist = 0;
+  int                fmt = FMT_RAW, quiet = 0, opt, i, alerts = 0;
+  size_t             have = 0, used;
+  ssize_t            got;
+  struct timespec    t0, t1;
+  struct sigaction   sa;
+  FILE              *f = stdin;
+
+  ncandles = 4096;
+  while((opt = getopt(argc, argv, "f:n:r:b:l:z:k:s:p:w:vqh")) != -1) {
+    switch(opt) {
+      case 'f': if(!strcmp(optarg, "text")) fmt = FMT_TEXT;
+                else if(strcmp(optarg, "raw")) usage();
+                break;
+      case 'n': ncandles = atoi(optarg); break;
+      case 'r': fps      = atof(optarg); break;
+      case 'b': block    = strtoul(optarg, NULL, 0); break;
+      case 'l': learn    = strtoul(optarg, NULL, 0); break;
+      case 'z': z        = atof(optarg); break;
+      case 'k': persist  = strtoul(optarg, NULL, 0); break;
+      case 's': stuck    = atof(optarg); break;
+      case 'p': proffile = optarg; break;
+      case 'w': outfile  = optarg; break;
+      case 'v': verbose  = 1; break;
+      case 'q': quiet    = 1; break;
+      default:  usage();
+    }
+  }
+  if(optind < argc - 1 || ncandles < 1 || ncandles > MAXCANDLES || fps < 0) usage();
+  if(optind < argc && !(f = fopen(argv[optind], "rb"))) {
+    fprintf(stderr, "Error: cannot open %s\n", argv[optind]);
+    return 1;
+  }
+  if(proffile && monitor_load(&ref, proffile)) {
+    fprintf(stderr, "Error: cannot read profile %s\n", proffile);
+    return 1;
+  }
+
+  // Alerts appear at once also on a pipe
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  // Stop on Ctrl-C, the read is interrupted
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onsignal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  // Trace header gives format and frame rate
+  while(have < sizeof(hdr) && (got = readsome(fileno(f), buf + have, sizeof(hdr) - have)) > 0)
+    have += got;
+  if(have == sizeof(hdr)) {
+    memcpy(&hdr, buf, sizeof(hdr));
+    if(hdr.magic == TRACE_MAGIC && hdr.channels == 2) {
+      fmt = FMT_TRACE;
+      have = 0;
+      if(!fps && hdr.fps > 0) fps = hdr.fps;
+    }
+  }
+  if(fmt == FMT_TRACE) ncandles = 1;
+
+  // Settings and candles
+  monitor_config(&config, fps ? fps : DEFAULTFPS);
+  if(block)   config.block   = (block + config.segment - 1) / config.segment * config.segment;
+  if(learn)   config.learn   = learn;
+  if(z > 0)   config.z       = z;
+  if(persist) config.persist = persist;
+  if(stuck > 0) config.stuck = (uint32_t)(stuck * config.fps);
+  if(!(candles = malloc(ncandles * sizeof(monitor_t)))) {
+    fprintf(stderr, "Error: out of memory\n");
+    return 1;
+  }
+  for(i = 0; i < ncandles; i++) monitor_init(&candles[i], &config, proffile ? &ref : NULL);
+
+  if(!quiet)
+    printf("Monitoring %s stream of %d candle%s at %.1f fps, %u frames per block, %s ...\n",
+           fmt == FMT_TRACE ? "trace" : fmt == FMT_TEXT ? "text" : "raw", ncandles,
+           ncandles == 1 ? "" : "s", config.fps, config.block,
+           proffile ? "reference profile" : "learning baselines");
+
+  // Stream, incomplete records are kept for the next read
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  while(!stop) {
+    used = fmt == FMT_TEXT ? parse_text(buf, have) : parse_binary(buf, have, fmt);
+    memmove(buf, buf + used, have - used);
+    have -= used;
+    if((got = readsome(fileno(f), buf + have, sizeof(buf) - have)) <= 0) break;
+    have += got;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if(f != stdin) fclose(f);
+
+  for(i = 0; i < ncandles; i++) alerts += candles[i].alerts > 0;
+  if(!quiet) summary((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+  if(outfile) {
+    if(!(i = average(&avg))) fprintf(stderr, "Warning: no candle learned a baseline, %s not written\n", outfile);
+    else if(monitor_save(&avg, outfile)) fprintf(stderr, "Error: cannot write %s\n", outfile);
+    else if(!quiet) printf("Profile of %d candle%s written to %s\n", i, i == 1 ? "" : "s", outfile);
+  }
+  free(candles);
+  return alerts ? 1 : 0;
+}
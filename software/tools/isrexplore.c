@@ -0,0 +1,557 @@
+// ===================================================================================
+// Project:   TinyCandle - Interrupt Interleaving Explorer
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Runs the firmware hex file on the ATtiny13A simulator and systematically preempts
+// the main loop by the interrupt service routines, to find state shared between main
+// and the ISRs which is not accessed atomically. After a warm-up, one window of the
+// main loop is executed as reference. Then every interrupt vector with a handler is
+// raised at every interleaving point of the window, on a copy of the simulator at that
+// point, and the data accesses of main and of the raised ISR are compared. An ISR
+// which is raised while the I flag is cleared runs after sei(), just as on the chip,
+// so atomic blocks are honored.
+//
+// Interleaving points are by default the instruction boundaries after every data
+// access of main (all boundaries between two accesses lead to the same order of
+// accesses); -a explores every instruction boundary. One access of main to a variable
+// (e.g. the two LDS of a 16-bit read, or LDS, SUBI, STS of an increment) is the
+// sequence of its parts around the ISR, taken nearest first: it ends before a byte
+// which is read or written a second time, before a backward jump (the next iteration
+// of a loop) and before a gap of more than -g instructions. An ISR which does not
+// return (e.g. a vector to __bad_interrupt, which restarts the firmware) is stopped
+// after a cycle limit and counted as missed. Reported are:
+//   torn read    main reads part of a multi-byte variable before and part after an ISR
+//                which writes it
+//   torn write   main writes part of a multi-byte variable before and part after an
+//                ISR which reads or writes it
+//   lost update  main reads a variable before and writes it after an ISR which writes
+//                it, so the write of the ISR is lost
+// Variables are taken from the symbol table (avr-nm -S tinycandle.elf > tinycandle.sym,
+// option -m), otherwise adjacent bytes accessed by consecutive instructions are merged
+// into one variable. I/O registers are checked as well (e.g. read-modify-write of PORTB
+// with IN/OUT), the stack and SREG are not.
+//
+// Usage:
+// ------
+// isrexplore [options] firmware.hex
+//   -f HZ      clock frequency in Hz (default 1200000)
+//   -w MS      warm-up time before the window in milliseconds (default 100)
+//   -t MS      length of the window in milliseconds (default 20)
+//   -v N       raise interrupt vector N (1-9 with handler, repeatable, default all)
+//   -m FILE    symbol table of the firmware (avr-nm -S)
+//   -g N       maximum instructions between the parts of one access (default 8)
+//   -a         explore every instruction boundary
+//
+// Returns 1 if a torn access or lost update was found.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "avrsim.h"
+
+// Default settings
+#define DEFAULTFREQ   1200000
+#define DEFAULTWARMUP 100
+#define DEFAULTWINDOW 20
+#define DEFAULTGAP    8
+#define MAXLOG        (1 << 20)   // data accesses of main in the window
+#define MAXISRLOG     4096        // data accesses of one ISR run
+#define MAXVARS       AVR_DATASIZE
+#define MAXFINDINGS   256
+#define MAXPARTS      8           // parts of one access (read and write of 4 bytes)
+#define MAXISRCYCLES  65536       // cycles of an ISR run until it counts as missed
+#define NVECTORS      10
+
+// Finding kinds
+enum {TORN_READ, TORN_WRITE, LOST_UPDATE, NKINDS};
+static const char *kindname[NKINDS] = {"torn read", "torn write", "lost update"};
+
+// Interrupt vectors of ATtiny13A
+static const char *vectname[NVECTORS] = {"RESET", "INT0", "PCINT0", "TIM0_OVF", "EE_RDY",
+                                         "ANA_COMP", "TIM0_COMPA", "TIM0_COMPB", "WDT", "ADC"};
+
+// Data access
+typedef struct {
+  uint32_t idx;                   // main instructions executed before
+  uint16_t pc;                    // word address of the instruction
+  uint8_t  addr;
+  uint8_t  write;
+} access_t;
+
+// Access log of a run, the memory hook context
+typedef struct {
+  access_t *main;                 // accesses of main
+  uint32_t  nmain, maxmain;
+  access_t  isr[MAXISRLOG];       // accesses of the raised ISR
+  uint32_t  nisr;
+  uint32_t  idx;                  // main instructions executed
+  uint16_t  pc;                   // instruction being executed
+  uint8_t   depth;                // nesting depth of the raised ISR, 0 if not running
+} run_t;
+
+// Variable in data space
+typedef struct {
+  char    name[32];
+  uint8_t addr, size;
+  uint8_t main;                   // accessed by main: bit 0 read, bit 1 write
+  uint8_t isr[NVECTORS];          // accessed by the ISRs
+} var_t;
+
+// Finding, points of the same accesses are counted
+typedef struct {
+  int      kind, var, vect;
+  uint16_t before, after;         // access of main before and after the ISR
+  uint32_t points;
+} finding_t;
+
+static var_t     vars[MAXVARS];
+static int       nvars;
+static int       varof[AVR_DATASIZE];   // variable of an address, -1 if not checked
+static uint8_t   joined[AVR_DATASIZE];  // address and the next belong to one variable
+static finding_t findings[MAXFINDINGS];
+static int       nfindings;
+static access_t  reflog[MAXLOG];
+static access_t  worklog[MAXLOG];
+static access_t  prelog[2 * MAXLOG];
+
+// ===================================================================================
+// Simulation
+// ===================================================================================
+
+// Data accesses which are checked: I/O and SRAM variables, not SREG, SP and the stack
+static int checked(const avr_t *m, uint16_t addr) {
+  if(addr < 0x20 || addr == AVR_SREG || addr == AVR_SPL) return 0;
+  return addr < AVR_RAMSTART || addr < m->data[AVR_SPL];
+}
+
+static void log_hook(avr_t *m, uint16_t addr, uint8_t value, uint8_t write, void *ctx) {
+  run_t   *r = (run_t *)ctx;
+  access_t a = {r->idx, r->pc, (uint8_t)addr, write};
+  (void)value;
+  if(!checked(m, addr)) return;
+  if(!m->isr) {
+    if(r->nmain < r->maxmain) r->main[r->nmain++] = a;
+  } else if(r->depth && m->isr >= r->depth && r->nisr < MAXISRLOG) r->isr[r->nisr++] = a;
+}
+
+// Execute one step and count the instructions of main
+static int step(avr_t *m, run_t *r) {
+  int main = !m->sleep && !m->halt && !m->isr;
+  int n;
+  r->pc = m->pc;
+  n = avr_step(m);
+  if(main && !m->isr && n) {
+    r->idx++;
+  }
+  return n;
+}
+
+// Vectors with a handler: the jump target differs from the common one (__bad_interrupt)
+static int handlers(const avr_t *m, uint8_t *use) {
+  int target[NVECTORS], i, j, common = -1, best = 0, n = 0;
+  for(i = 1; i < NVECTORS; i++) {
+    uint16_t op = m->flash[i];
+    target[i] = ((op & 0xF000) == 0xC000) ? (i + 1 + ((int16_t)(op << 4) >> 4)) & (AVR_FLASHWORDS - 1) : i;
+  }
+  for(i = 1; i < NVECTORS; i++) {
+    int k = 0;
+    for(j = 1; j < NVECTORS; j++) k += target[j] == target[i];
+    if(k > best) {
+      best   = k;
+      common = target[i];
+    }
+  }
+  for(i = 1; i < NVECTORS; i++) {
+    use[i] = best == 1 || target[i] != common;
+    n += use[i];
+  }
+  return n;
+}
+
+// ===================================================================================
+// Variables
+// ===================================================================================
+
+// Names of the I/O registers of ATtiny13A (data space 0x20-0x5F)
+static const char *ioname(uint8_t addr) {
+  static const struct {uint8_t addr; const char *name;} io[] = {
+    {AVR_PINB, "PINB"}, {AVR_DDRB, "DDRB"}, {AVR_PORTB, "PORTB"}, {AVR_PCMSK, "PCMSK"},
+    {AVR_WDTCR, "WDTCR"}, {AVR_PRR, "PRR"}, {AVR_OCR0B, "OCR0B"}, {AVR_TCCR0A, "TCCR0A"},
+    {AVR_TCNT0, "TCNT0"}, {AVR_TCCR0B, "TCCR0B"}, {AVR_MCUCR, "MCUCR"}, {AVR_OCR0A, "OCR0A"},
+    {AVR_TIFR0, "TIFR0"}, {AVR_TIMSK0, "TIMSK0"}, {AVR_GIFR, "GIFR"}, {AVR_GIMSK, "GIMSK"}};
+  size_t i;
+  for(i = 0; i < sizeof(io) / sizeof(io[0]); i++) if(io[i].addr == addr) return io[i].name;
+  return NULL;
+}
+
+// Add variable, returns its index
+static int addvar(const char *name, int addr, int size) {
+  var_t *v = &vars[nvars];
+  int    i;
+  if(nvars == MAXVARS) return -1;
+  memset(v, 0, sizeof(*v));
+  if(addr + size > AVR_DATASIZE) size = AVR_DATASIZE - addr;
+  snprintf(v->name, sizeof(v->name), "%s", name);
+  v->addr = addr;
+  v->size = size;
+  for(i = addr; i < addr + size; i++) varof[i] = nvars;
+  return nvars++;
+}
+
+// Read data symbols of avr-nm (-S), returns 0 on success
+static int readsymbols(const char *filename) {
+  FILE    *f = fopen(filename, "r");
+  char     line[256], type, name[64];
+  unsigned addr, size;
+  if(!f) return -1;
+  while(fgets(line, sizeof(line), f)) {
+    if(sscanf(line, "%x %x %c %63s", &addr, &size, &type, name) != 4) {
+      if(sscanf(line, "%x %c %63s", &addr, &type, name) != 3) continue;
+      size = 1;
+    }
+    if(!strchr("bBdD", type) || !(addr & 0x800000)) continue;
+    addr &= 0xFFFF;
+    if(addr >= AVR_RAMSTART && addr < AVR_DATASIZE && size) addvar(name, addr, size);
+  }
+  fclose(f);
+  return 0;
+}
+
+// Merge adjacent bytes accessed by the same or consecutive instructions
+static void join(const access_t *log, uint32_t n) {
+  uint32_t i;
+  for(i = 1; i < n; i++) {
+    const access_t *a = &log[i - 1], *b = &log[i];
+    if(a->write != b->write || b->idx - a->idx > 1 || a->addr < AVR_RAMSTART || b->addr < AVR_RAMSTART)
+      continue;
+    if(b->addr == a->addr + 1) joined[a->addr] = 1;
+    if(a->addr == b->addr + 1) joined[b->addr] = 1;
+  }
+}
+
+// Variables of all addresses which are not in the symbol table
+static void makevars(void) {
+  char name[32];
+  int  a = 0x20, n;
+  while(a < AVR_DATASIZE) {
+    if(varof[a] >= 0) {
+      a++;
+      continue;
+    }
+    if(a < AVR_RAMSTART) {
+      if(ioname(a)) addvar(ioname(a), a, 1);
+      else {
+        snprintf(name, sizeof(name), "io 0x%02x", a - 0x20);
+        addvar(name, a, 1);
+      }
+      a++;
+      continue;
+    }
+    for(n = 1; a + n < AVR_DATASIZE && joined[a + n - 1] && varof[a + n] < 0; n++);
+    snprintf(name, sizeof(name), "0x%04x", a);
+    addvar(name, a, n);
+    a += n;
+  }
+}
+
+// ===================================================================================
+// Analysis
+// ===================================================================================
+
+static void report(int kind, int var, int vect, uint16_t before, uint16_t after) {
+  int i;
+  for(i = 0; i < nfindings; i++) {
+    finding_t *f = &findings[i];
+    if(f->kind == kind && f->var == var && f->vect == vect && f->before == before && f->after == after) {
+      f->points++;
+      return;
+    }
+  }
+  if(nfindings == MAXFINDINGS) return;
+  findings[nfindings++] = (finding_t){kind, var, vect, before, after, 1};
+}
+
+// Compare the access of main around the ISR with the accesses of the ISR. The
+// accesses of main are pre[0..npre) before and post[0..npost) after the ISR.
+static void analyze(const run_t *r, int vect, uint32_t entry, int gap,
+                    const access_t *pre, uint32_t npre, const access_t *post, uint32_t npost) {
+  uint64_t isrr[MAXVARS], isrw[MAXVARS];
+  uint32_t i;
+  int      v;
+
+  memset(isrr, 0, sizeof(isrr));
+  memset(isrw, 0, sizeof(isrw));
+  for(i = 0; i < r->nisr; i++) {
+    const access_t *a = &r->isr[i];
+    v = varof[a->addr];
+    if(v < 0) continue;
+    if(a->write) isrw[v] |= 1ULL << ((a->addr - vars[v].addr) & 63);
+    else         isrr[v] |= 1ULL << ((a->addr - vars[v].addr) & 63);
+    vars[v].isr[vect] |= a->write ? 2 : 1;
+  }
+
+  for(v = 0; v < nvars; v++) {
+    uint64_t prer = 0, prew = 0, postr = 0, postw = 0, seen[2] = {0, 0};
+    uint32_t ip = npre, iq = 0, lo = entry, hi = entry;
+    uint16_t before = 0, after = 0, pclo = 0, pchi = 0;
+    int      npart = 0, nq = 0;
+    if(!isrr[v] && !isrw[v]) continue;
+
+    // Grow the access of main nearest first on both sides of the ISR: every byte is
+    // read and written at most once, in program order and without gaps. Recorded are
+    // the bytes whose last part before the ISR is a read or write (value of main in
+    // registers or partially written) and whose first part after the ISR is a read or
+    // write.
+    while(npart < MAXPARTS) {
+      const access_t *a = NULL, *b = NULL;
+      uint64_t        abit = 0, bbit = 0;
+      while(ip > 0 && varof[pre[ip - 1].addr] != v) ip--;
+      while(iq < npost && varof[post[iq].addr] != v) iq++;
+      if(ip > 0) {
+        a    = &pre[ip - 1];
+        abit = 1ULL << ((a->addr - vars[v].addr) & 63);
+        if(lo - a->idx > (uint32_t)gap || (seen[a->write] & abit) || (npart && a->pc > pclo)) a = NULL;
+      }
+      if(iq < npost) {
+        b    = &post[iq];
+        bbit = 1ULL << ((b->addr - vars[v].addr) & 63);
+        if(b->idx + !nq - hi > (uint32_t)gap || (seen[b->write] & bbit) || (npart && b->pc < pchi)) b = NULL;
+      }
+      if(a && b && entry - a->idx > b->idx + 1 - entry) a = NULL;
+      if(a) {
+        if(!((prer | prew) & abit)) {
+          if(a->write) prew |= abit;
+          else         prer |= abit;
+        }
+        if(lo == entry) before = a->pc;
+        if(!npart) pchi = a->pc;
+        seen[a->write] |= abit;
+        lo   = a->idx;
+        pclo = a->pc;
+        ip--;
+      } else if(b) {
+        if(!((postr | postw) & bbit)) {
+          if(b->write) postw |= bbit;
+          else         postr |= bbit;
+        }
+        if(!nq++) after = b->pc;
+        if(!npart) pclo = b->pc;
+        seen[b->write] |= bbit;
+        hi   = b->idx;
+        pchi = b->pc;
+        iq++;
+      } else break;
+      npart++;
+    }
+    if(!(prer | prew) || !(postr | postw)) continue;
+
+    if(vars[v].size > 1 && (prer & ~postr) && (postr & ~prer) && ((prer | postr) & isrw[v]))
+      report(TORN_READ, v, vect, before, after);
+    if(vars[v].size > 1 && (prew & ~postw) && (postw & ~prew) && ((prew | postw) & (isrr[v] | isrw[v])))
+      report(TORN_WRITE, v, vect, before, after);
+    if(prer & postw & isrw[v])
+      report(LOST_UPDATE, v, vect, before, after);
+  }
+}
+
+// ===================================================================================
+// Main
+// ===================================================================================
+
+// Print usage
+static void usage(void) {
+  fprintf(stderr,
+    "Usage: isrexplore [options] firmware.hex\n"
+    "  -f HZ      clock frequency in Hz (default %d)\n"
+    "  -w MS      warm-up time before the window in milliseconds (default %d)\n"
+    "  -t MS      length of the window in milliseconds (default %d)\n"
+    "  -v N       raise interrupt vector N (1-9 with handler, repeatable, default all)\n"
+    "  -m FILE    symbol table of the firmware (avr-nm -S)\n"
+    "  -g N       maximum instructions between the parts of one access (default %d)\n"
+    "  -a         explore every instruction boundary\n",
+    DEFAULTFREQ, DEFAULTWARMUP, DEFAULTWINDOW, DEFAULTGAP);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static avr_t start, cursor, work;
+  static run_t ref, run, cur;
+  uint8_t  use[NVECTORS] = {0}, has[NVECTORS] = {0};
+  uint32_t freq = DEFAULTFREQ, window, points = 0, deferred = 0, missed = 0, p, next, i;
+  double   warmup = DEFAULTWARMUP, length = DEFAULTWINDOW;
+  char    *symfile = NULL;
+  int      gap = DEFAULTGAP, all = 0, vectors = 0, opt, v, k;
+  uint64_t end, limit;
+
+  // Parse command line
+  while((opt = getopt(argc, argv, "f:w:t:v:m:g:ah")) != -1) {
+    switch(opt) {
+      case 'f': freq    = strtoul(optarg, NULL, 0); break;
+      case 'w': warmup  = atof(optarg); break;
+      case 't': length  = atof(optarg); break;
+      case 'm': symfile = optarg; break;
+      case 'g': gap     = atoi(optarg); break;
+      case 'a': all     = 1; break;
+      case 'v':
+        v = atoi(optarg);
+        if(v < 1 || v >= NVECTORS) usage();
+        use[v]  = 1;
+        vectors = 1;
+        break;
+      default:  usage();
+    }
+  }
+  if(optind != argc - 1 || !freq || gap < 1) usage();
+  for(i = 0; i < AVR_DATASIZE; i++) varof[i] = -1;
+  if(symfile && readsymbols(symfile)) {
+    fprintf(stderr, "Error: cannot read %s\n", symfile);
+    return 1;
+  }
+
+  // Load firmware and run it into the main loop
+  avr_init(&start, freq);
+  if(avr_loadhex(&start, argv[optind]) <= 0) {
+    fprintf(stderr, "Error: cannot load %s\n", argv[optind]);
+    return 1;
+  }
+  if(!handlers(&start, has) && !vectors) {
+    printf("No interrupt handlers, nothing to explore\n");
+    return 0;
+  }
+  for(v = 1; v < NVECTORS; v++) {
+    if(!vectors) use[v] = has[v];
+    else if(use[v] && !has[v]) {
+      fprintf(stderr, "Error: vector %d (%s) has no handler, it jumps to __bad_interrupt\n", v, vectname[v]);
+      return 1;
+    }
+  }
+  end = (uint64_t)(warmup * freq / 1000);
+  while(start.cycles < end && !start.fault) avr_step(&start);
+  while((start.isr || start.sleep || start.halt) && !start.fault) avr_step(&start);
+
+  // Reference run of the window
+  ref.main    = reflog;
+  ref.maxmain = MAXLOG;
+  cursor = start;
+  cursor.memhook = log_hook;
+  cursor.memctx  = &ref;
+  end = cursor.cycles + (uint64_t)(length * freq / 1000);
+  while(cursor.cycles < end && !cursor.fault && ref.nmain < MAXLOG) step(&cursor, &ref);
+  if(cursor.fault) {
+    fprintf(stderr, "Error: %s at 0x%04x\n", avr_strfault(cursor.fault), cursor.faultpc * 2);
+    return 1;
+  }
+  window = ref.idx;
+  join(reflog, ref.nmain);
+
+  // Accesses of the ISRs to find their multi-byte variables
+  for(v = 1; v < NVECTORS; v++) {
+    if(!use[v]) continue;
+    memset(&run, 0, sizeof(run));
+    work = start;
+    work.memhook = log_hook;
+    work.memctx  = &run;
+    avr_interrupt(&work, v);
+    while(work.forced && !work.fault && run.idx < window) step(&work, &run);
+    run.depth = work.isr;
+    limit     = work.cycles + MAXISRCYCLES;
+    while(work.isr >= run.depth && !work.fault && work.cycles < limit) step(&work, &run);
+    join(run.isr, run.nisr);
+  }
+  makevars();
+  for(i = 0; i < ref.nmain; i++) if(varof[reflog[i].addr] >= 0)
+    vars[varof[reflog[i].addr]].main |= reflog[i].write ? 2 : 1;
+
+  // Explore the interleaving points in order, the cursor is advanced to each of them
+  cursor = start;
+  memset(&cur, 0, sizeof(cur));
+  cursor.memhook = NULL;
+  for(p = 0, next = 0; p < window; p++) {
+    uint32_t first;
+    while(next < ref.nmain && reflog[next].idx < p) next++;
+    if(!all && p && !(next && reflog[next - 1].idx == p - 1)) continue;
+    while(cur.idx < p && !cursor.fault) step(&cursor, &cur);
+    if(cursor.fault) break;
+    points++;
+
+    // Accesses of main which can be parts of an access before the point
+    for(first = next; first > 0 && reflog[first - 1].idx + MAXPARTS * gap >= p; first--);
+
+    for(v = 1; v < NVECTORS; v++) {
+      uint32_t entry;
+      if(!use[v]) continue;
+      memset(&run, 0, sizeof(run));
+      run.main    = worklog;
+      run.maxmain = MAXLOG;
+      run.idx     = p;
+      work = cursor;
+      work.memhook = log_hook;
+      work.memctx  = &run;
+
+      // Raise the interrupt, main continues until it is taken
+      avr_interrupt(&work, v);
+      while(work.forced && !work.fault && run.idx < window) step(&work, &run);
+      if(work.forced || work.fault) {
+        missed++;
+        continue;
+      }
+      entry = run.idx;
+      run.depth = work.isr;
+      limit     = work.cycles + MAXISRCYCLES;
+      while(work.isr >= run.depth && !work.fault && work.cycles < limit) step(&work, &run);
+      if(work.isr >= run.depth || work.fault) {
+        missed++;
+        continue;
+      }
+      if(entry > p) deferred++;
+      while(run.idx < entry + MAXPARTS * gap && run.idx < window && !work.fault) step(&work, &run);
+
+      // Accesses of main before the ISR: reference up to the point and then the run
+      for(k = 0; k < (int)run.nmain && worklog[k].idx < entry; k++);
+      memcpy(prelog, &reflog[first], (next - first) * sizeof(access_t));
+      memcpy(&prelog[next - first], worklog, k * sizeof(access_t));
+      analyze(&run, v, entry, gap, prelog, next - first + k, &worklog[k], run.nmain - k);
+    }
+  }
+
+  // Shared variables
+  printf("Window:      %u main instructions after %.0f ms, %u interleaving points\n",
+         window, warmup, points);
+  printf("Vectors:    ");
+  for(v = 1; v < NVECTORS; v++) if(use[v]) printf(" %s", vectname[v]);
+  printf("\n");
+  printf("Shared:     ");
+  for(k = 0, i = 0; i < (uint32_t)nvars; i++) {
+    var_t *s = &vars[i];
+    int    isr = 0;
+    for(v = 1; v < NVECTORS; v++) isr |= s->isr[v];
+    if(!s->main || !isr || (s->main | isr) == 1) continue;
+    printf("%s %s (0x%04x, %d byte%s)", k++ ? "," : "", s->name, s->addr, s->size, s->size > 1 ? "s" : "");
+  }
+  printf("%s\n", k ? "" : " none");
+
+  // Findings
+  for(k = 0; k < NKINDS; k++) {
+    for(i = 0; i < (uint32_t)nfindings; i++) {
+      finding_t *f = &findings[i];
+      var_t     *s = &vars[f->var];
+      if(f->kind != k) continue;
+      printf("%-12s %s (0x%04x, %d byte%s) by %s: main at 0x%04x, ISR, main at 0x%04x (%u point%s)\n",
+             kindname[k], s->name, s->addr, s->size, s->size > 1 ? "s" : "", vectname[f->vect],
+             f->before * 2, f->after * 2, f->points, f->points > 1 ? "s" : "");
+    }
+  }
+  if(deferred) printf("Deferred:    %u runs, interrupt taken after sei()\n", deferred);
+  if(missed)   printf("Missed:      %u runs, interrupt not taken within the window or ISR not\n"
+                     "             returned within %d cycles\n", missed, MAXISRCYCLES);
+  printf("Result:      %d finding%s\n", nfindings, nfindings == 1 ? "" : "s");
+  return nfindings ? 1 : 0;
+}
@@ -0,0 +1,221 @@
+// ===================================================================================
+// Project:   TinyCandle - Online Flicker Quality Monitor
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "engine.h"                // MAXDEV
+#include "monitor.h"
+
+#define CLIPLOW       (128 - MAXDEV)
+#define CLIPHIGH      (128 + MAXDEV)
+#define FLOORREL      0.05f       // minimum spread relative to the baseline mean
+#define FLOORABS      0.01f       // minimum spread of metrics with zero baseline
+
+// Band frequencies in Hz (candle flicker is below 10 Hz)
+static const float freqs[MON_BANDS] = {0.5f, 1.0f, 2.0f, 4.0f, 8.0f};
+
+// Default settings for the frame rate
+void monitor_config(monitor_config_t *c, double fps) {
+  int k;
+  memset(c, 0, sizeof(*c));
+  c->fps     = fps;
+  c->block   = 4096;              // about one calm/uncalm cycle of the firmware
+  c->segment = 256;               // 0.25 Hz resolution at 63 fps
+  c->learn   = 8;
+  c->stuck   = (uint32_t)(5 * fps);
+  c->persist = 2;
+  c->z       = 6;
+  for(k = 0; k < MON_BANDS; k++) {
+    c->freq[k] = freqs[k];
+    c->coef[k] = 2 * cosf(2 * (float)M_PI * freqs[k] / (float)fps);
+  }
+}
+
+// Start new block
+static void newblock(monitor_t *m) {
+  memset(m->mean,  0, sizeof(m->mean));
+  memset(m->m2,    0, sizeof(m->m2));
+  memset(m->s1,    0, sizeof(m->s1));
+  memset(m->s2,    0, sizeof(m->s2));
+  memset(m->power, 0, sizeof(m->power));
+  m->n = m->clips = m->gusts = 0;
+}
+
+// Start candle, with a reference profile (no learning) or NULL
+void monitor_init(monitor_t *m, const monitor_config_t *c, const monitor_profile_t *ref) {
+  memset(m, 0, sizeof(*m));
+  m->calm  = UINT32_MAX;
+  m->worst = -1;
+  if(ref) {
+    m->base   = *ref;
+    m->blocks = c->learn;
+  }
+}
+
+// Name of a metric
+const char *monitor_metric(int i) {
+  static const char *names[MON_METRICS] = {
+    "meanA", "meanB", "stdA", "stdB", "clip", "gusts",
+    "bandA0.5", "bandA1", "bandA2", "bandA4", "bandA8",
+    "bandB0.5", "bandB1", "bandB2", "bandB4", "bandB8"
+  };
+  return i >= 0 && i < MON_METRICS ? names[i] : "?";
+}
+
+// Metrics of the completed block
+static void metrics(monitor_t *m) {
+  float n = (float)m->n;
+  int   ch, k;
+  for(ch = 0; ch < 2; ch++) {
+    m->metric[MON_MEAN(ch)] = m->mean[ch];
+    m->metric[MON_STD(ch)]  = sqrtf(m->m2[ch] / n);
+    for(k = 0; k < MON_BANDS; k++)
+      m->metric[MON_BAND(ch, k)] = log10f(m->power[ch][k] / n + 1e-3f);
+  }
+  m->metric[MON_CLIP]  = m->clips / n;
+  m->metric[MON_GUSTS] = (float)m->gusts;
+}
+
+// Learn or test the block metrics, returns events
+static int baseline(monitor_t *m, const monitor_config_t *c) {
+  monitor_profile_t *b = &m->base;
+  int   i;
+
+  // Welford over the blocks, spread holds M2 until the baseline is complete
+  if(m->blocks < c->learn) {
+    m->blocks++;
+    for(i = 0; i < MON_METRICS; i++) {
+      float d = m->metric[i] - b->mean[i];
+      b->mean[i]   += d / m->blocks;
+      b->spread[i] += d * (m->metric[i] - b->mean[i]);
+    }
+    if(m->blocks < c->learn) return 0;
+    for(i = 0; i < MON_METRICS; i++) b->spread[i] = sqrtf(b->spread[i] / m->blocks);
+    return MON_LEARNED;
+  }
+
+  // Largest departure, with the spread limited to a fraction of the mean
+  m->worst  = -1;
+  m->zworst = 0;
+  for(i = 0; i < MON_METRICS; i++) {
+    float s = b->spread[i], f = FLOORREL * fabsf(b->mean[i]);
+    float z;
+    if(s < f) s = f;
+    if(s < FLOORABS) s = FLOORABS;
+    z = fabsf(m->metric[i] - b->mean[i]) / s;
+    if(z > m->zworst) {
+      m->zworst = z;
+      m->worst  = i;
+    }
+  }
+  if(m->zworst <= c->z) {
+    m->over = 0;
+    return 0;
+  }
+  if(++m->over != c->persist) return 0;
+  m->alerts++;
+  return MON_DEPART;
+}
+
+// Process one frame, returns MON_* events
+int monitor_frame(monitor_t *m, const monitor_config_t *c, uint8_t ocra, uint8_t ocrb) {
+  uint8_t v[2] = {ocra, ocrb};
+  int     ch, k, events = 0;
+
+  m->n++;
+  m->frames++;
+  for(ch = 0; ch < 2; ch++) {
+    float x = v[ch], d = x - m->mean[ch];
+    m->mean[ch] += d / m->n;
+    m->m2[ch]   += d * (x - m->mean[ch]);
+
+    // Goertzel around the center to keep DC out of the low bands
+    x -= 128;
+    for(k = 0; k < MON_BANDS; k++) {
+      float s = x + c->coef[k] * m->s1[ch][k] - m->s2[ch][k];
+      m->s2[ch][k] = m->s1[ch][k];
+      m->s1[ch][k] = s;
+    }
+
+    // Stuck output, reported once when the run reaches the stuck time
+    if(v[ch] != m->last[ch]) {
+      m->last[ch] = v[ch];
+      m->run[ch]  = 0;
+    }
+    else if(++m->run[ch] == c->stuck) {
+      m->alerts++;
+      events |= MON_STUCK;
+    }
+  }
+
+  // Clipping and gusts
+  if(ocra == CLIPLOW || ocra == CLIPHIGH || ocrb == CLIPLOW || ocrb == CLIPHIGH) {
+    m->clips++;
+    m->totalclips++;
+    if(m->calm >= c->fps) {
+      m->gusts++;
+      m->totalgusts++;
+    }
+    m->calm = 0;
+  }
+  else if(m->calm < UINT32_MAX) m->calm++;
+
+  // Energy of the completed Goertzel segment
+  if(m->n % c->segment == 0) {
+    for(ch = 0; ch < 2; ch++) {
+      for(k = 0; k < MON_BANDS; k++) {
+        float s1 = m->s1[ch][k], s2 = m->s2[ch][k];
+        m->power[ch][k] += s1 * s1 + s2 * s2 - c->coef[k] * s1 * s2;
+        m->s1[ch][k] = m->s2[ch][k] = 0;
+      }
+    }
+  }
+
+  if(m->n == c->block) {
+    metrics(m);
+    events |= MON_BLOCK | baseline(m, c);
+    newblock(m);
+  }
+  return events;
+}
+
+// Read profile file, 0 on success
+int monitor_load(monitor_profile_t *p, const char *filename) {
+  FILE *f = fopen(filename, "r");
+  char  line[128], name[32];
+  float mean, spread;
+  int   i, found = 0;
+
+  if(!f) return -1;
+  memset(p, 0, sizeof(*p));
+  while(fgets(line, sizeof(line), f)) {
+    if(sscanf(line, "%31s %f %f", name, &mean, &spread) != 3) continue;
+    for(i = 0; i < MON_METRICS; i++) {
+      if(strcmp(name, monitor_metric(i))) continue;
+      p->mean[i]   = mean;
+      p->spread[i] = spread;
+      found++;
+    }
+  }
+  fclose(f);
+  return found == MON_METRICS ? 0 : -1;
+}
+
+// Write profile file, 0 on success
+int monitor_save(const monitor_profile_t *p, const char *filename) {
+  FILE *f = fopen(filename, "w");
+  int   i;
+
+  if(!f) return -1;
+  fprintf(f, "# metric mean spread\n");
+  for(i = 0; i < MON_METRICS; i++)
+    fprintf(f, "%-10s %12.6g %12.6g\n", monitor_metric(i), p->mean[i], p->spread[i]);
+  return fclose(f);
+}
@@ -0,0 +1,108 @@
+// ===================================================================================
+// Project:   TinyCandle - Online Flicker Quality Monitor
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Streaming statistics of the OCR0A/OCR0B frames of a candle in constant memory, for
+// watching thousands of candles of a live installation at once. Every frame updates
+// the mean and variance (Welford), the energy of a few flicker bands (Goertzel over
+// short segments, averaged over the block to tame the spread of a single bin), the
+// clipped frames at +-MAXDEV, the gusts (bursts of clipping after at least one second
+// without) and the time since each output last changed. After every block of frames,
+// the block metrics (mean, standard deviation, clip rate, gusts and log band energies
+// per channel) are compared with the baseline profile of the candle: the mean and
+// spread of the metrics over the first blocks (learning) or a reference profile. A
+// candle departs from its baseline when a metric is more than z spreads away for
+// several blocks in a row. An output which does not change for the stuck time raises
+// an alert at once.
+
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdint.h>
+
+#define MON_BANDS     5           // Goertzel bands per channel
+#define MON_METRICS   (2 * (3 + MON_BANDS))
+
+// Metrics of a block: per channel mean, deviation, log10 band energies, clip rate and
+// gusts
+#define MON_MEAN(ch)      (ch)
+#define MON_STD(ch)       (2 + (ch))
+#define MON_CLIP          4
+#define MON_GUSTS         5
+#define MON_BAND(ch, k)   (6 + (ch) * MON_BANDS + (k))
+
+// Events of a frame
+#define MON_STUCK     0x01        // an output did not change for the stuck time
+#define MON_DEPART    0x02        // block metrics departed from the baseline
+#define MON_LEARNED   0x04        // baseline learned
+#define MON_BLOCK     0x08        // block completed
+
+// Settings shared by all candles
+typedef struct {
+  double   fps;                   // frame rate
+  uint32_t block;                 // frames per block (multiple of segment)
+  uint32_t segment;               // frames per Goertzel segment
+  uint32_t learn;                 // blocks to learn the baseline
+  uint32_t stuck;                 // frames without change for a stuck output
+  uint32_t persist;               // departed blocks in a row for an alert
+  float    z;                     // departure threshold in spreads
+  float    freq[MON_BANDS];       // band frequencies in Hz
+  float    coef[MON_BANDS];       // Goertzel coefficients 2 cos(2 pi f / fps)
+} monitor_config_t;
+
+// Baseline profile: mean and spread of every block metric
+typedef struct {
+  float mean[MON_METRICS];
+  float spread[MON_METRICS];
+} monitor_profile_t;
+
+// State of a candle
+typedef struct {
+  // Current block
+  float    mean[2], m2[2];        // Welford
+  float    s1[2][MON_BANDS];      // Goertzel
+  float    s2[2][MON_BANDS];
+  float    power[2][MON_BANDS];   // sum over the completed segments
+  uint32_t n;                     // frames in block
+  uint32_t clips, gusts;
+  uint32_t calm;                  // frames since the last clipping
+  uint32_t run[2];                // frames since the output changed
+  uint8_t  last[2];               // last output
+
+  // Baseline (Welford over the block metrics while learning)
+  uint32_t blocks;                // learned blocks
+  uint32_t over;                  // departed blocks in a row
+  monitor_profile_t base;
+  float    metric[MON_METRICS];   // metrics of the last block
+  int      worst;                 // metric with the largest departure
+  float    zworst;
+
+  // Totals
+  uint64_t frames, totalclips, totalgusts;
+  uint32_t alerts;
+} monitor_t;
+
+// Default settings for the frame rate
+void monitor_config(monitor_config_t *c, double fps);
+
+// Start candle, with a reference profile (no learning) or NULL
+void monitor_init(monitor_t *m, const monitor_config_t *c, const monitor_profile_t *ref);
+
+// Process one frame, returns MON_* events
+int  monitor_frame(monitor_t *m, const monitor_config_t *c, uint8_t ocra, uint8_t ocrb);
+
+// Name of a metric
+const char *monitor_metric(int i);
+
+// Read and write profile file (one line "name mean spread" per metric), 0 on success
+int  monitor_load(monitor_profile_t *p, const char *filename);
+int  monitor_save(const monitor_profile_t *p, const char *filename);
+
+#endif
@@ -0,0 +1,266 @@
+// ===================================================================================
+// Project:   TinyCandle - Performance History Report
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Renders the performance history collected by "make history" as static HTML page
+// with a chart of flash bytes, busy cycles per frame (updateCandle() and main loop),
+// stack high-water mark and energy per hour over the commits, and a table of all
+// commits in which every change against the previous commit beyond a threshold is
+// marked as regression (red) or improvement (green). The history is a CSV file with
+// one line per commit in any order:
+//   commit,order,date,subject,flash,sram,stack,cycles,busy,fps,current,energy
+// The commits are sorted by order (number of ancestors). Commits which did not build
+// have empty measurements.
+//
+// Usage:
+// ------
+// perfreport [options] history.csv
+//   -o FILE    HTML output file (default history.html)
+//   -t PCT     change in percent marked as regression/improvement (default 0.5)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Report settings
+#define MAXCOMMITS    4096
+#define CHARTW        900         // chart size in pixels
+#define CHARTH        160
+#define MARGIN        50
+
+// Measurements of a commit
+enum {M_FLASH, M_SRAM, M_STACK, M_CYCLES, M_BUSY, M_FPS, M_CURRENT, M_ENERGY, NMETRICS};
+
+typedef struct {
+  char   commit[16];
+  long   order;
+  char   date[16];
+  char   subject[128];
+  int    built;
+  double m[NMETRICS];
+} commit_t;
+
+// Metrics in the report: index, name, unit, format
+static const struct {
+  int         index;
+  const char *name;
+  const char *unit;
+  const char *format;
+} charts[] = {
+  {M_FLASH,  "Flash",            "bytes",     "%.0f"},
+  {M_BUSY,   "updateCandle()",   "cycles",    "%.0f"},
+  {M_STACK,  "Stack high-water", "bytes",     "%.0f"},
+  {M_ENERGY, "Energy",           "mWh/h",     "%.1f"}
+};
+#define NCHARTS       (sizeof(charts) / sizeof(charts[0]))
+
+static commit_t commits[MAXCOMMITS];
+static int      ncommits;
+
+// Copy CSV field and advance to the next one
+static char *field(char *p, char *out, size_t size) {
+  size_t n = strcspn(p, ",\n");
+  if(out) snprintf(out, size, "%.*s", (int)n, p);
+  p += n;
+  return *p == ',' ? p + 1 : p;
+}
+
+// Read history, returns number of commits or -1
+static int readcsv(const char *filename) {
+  FILE *f = fopen(filename, "r");
+  char  line[512], value[32];
+  int   i;
+
+  if(!f) return -1;
+  while(ncommits < MAXCOMMITS && fgets(line, sizeof(line), f)) {
+    commit_t *c = &commits[ncommits];
+    char     *p = line;
+    if(!strncmp(line, "commit,", 7)) continue;
+    memset(c, 0, sizeof(*c));
+    p = field(p, c->commit,  sizeof(c->commit));
+    p = field(p, value,      sizeof(value));
+    c->order = atol(value);
+    p = field(p, c->date,    sizeof(c->date));
+    p = field(p, c->subject, sizeof(c->subject));
+    c->built = 1;
+    for(i = 0; i < NMETRICS; i++) {
+      p = field(p, value, sizeof(value));
+      if(!value[0]) c->built = 0;
+      c->m[i] = atof(value);
+    }
+    if(c->commit[0]) ncommits++;
+  }
+  fclose(f);
+  return ncommits;
+}
+
+// Sort commits by history
+static int cmporder(const void *a, const void *b) {
+  long d = ((const commit_t *)a)->order - ((const commit_t *)b)->order;
+  return (d > 0) - (d < 0);
+}
+
+// Write text with HTML special characters escaped
+static void html(FILE *f, const char *s) {
+  for(; *s; s++) {
+    if(*s == '<') fputs("&lt;", f);
+    else if(*s == '>') fputs("&gt;", f);
+    else if(*s == '&') fputs("&amp;", f);
+    else if(*s == '"') fputs("&quot;", f);
+    else fputc(*s, f);
+  }
+}
+
+// Previous commit which was built, -1 if none
+static int previous(int i) {
+  while(--i >= 0) if(commits[i].built) return i;
+  return -1;
+}
+
+// Relative change of a metric against the previous commit in percent
+static double change(int i, int m) {
+  int p = previous(i);
+  if(p < 0 || !commits[i].built || commits[p].m[m] == 0) return 0;
+  return 100 * (commits[i].m[m] - commits[p].m[m]) / commits[p].m[m];
+}
+
+// Line chart of a metric over the commits as SVG
+static void chart(FILE *f, int c, double threshold) {
+  int    m = charts[c].index, i, first = 1;
+  double lo = 1e300, hi = -1e300, x, y;
+  char   label[32];
+
+  for(i = 0; i < ncommits; i++) {
+    if(!commits[i].built) continue;
+    if(commits[i].m[m] < lo) lo = commits[i].m[m];
+    if(commits[i].m[m] > hi) hi = commits[i].m[m];
+  }
+  if(lo > hi) return;
+  if(hi - lo < 1e-9) {
+    lo -= 1;
+    hi += 1;
+  }
+  fprintf(f, "<h2>%s (%s)</h2>\n", charts[c].name, charts[c].unit);
+  fprintf(f, "<svg width=\"%d\" height=\"%d\">\n", CHARTW + 2 * MARGIN, CHARTH + 2 * MARGIN);
+  fprintf(f, "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" class=\"frame\"/>\n",
+          MARGIN, MARGIN / 2, CHARTW, CHARTH);
+  snprintf(label, sizeof(label), charts[c].format, hi);
+  fprintf(f, "<text x=\"%d\" y=\"%d\" class=\"axis\">%s</text>\n", MARGIN - 4, MARGIN / 2 + 4, label);
+  snprintf(label, sizeof(label), charts[c].format, lo);
+  fprintf(f, "<text x=\"%d\" y=\"%d\" class=\"axis\">%s</text>\n", MARGIN - 4, MARGIN / 2 + CHARTH + 4, label);
+
+  // Line through all built commits
+  fprintf(f, "<polyline class=\"line\" points=\"");
+  for(i = 0; i < ncommits; i++) {
+    if(!commits[i].built) continue;
+    x = MARGIN + (ncommits > 1 ? (double)i * CHARTW / (ncommits - 1) : CHARTW / 2);
+    y = MARGIN / 2 + CHARTH * (hi - commits[i].m[m]) / (hi - lo);
+    fprintf(f, "%s%.1f,%.1f", first ? "" : " ", x, y);
+    first = 0;
+  }
+  fprintf(f, "\"/>\n");
+
+  // Points with tooltip, colored by the change against the previous commit
+  for(i = 0; i < ncommits; i++) {
+    double d = change(i, m);
+    if(!commits[i].built) continue;
+    x = MARGIN + (ncommits > 1 ? (double)i * CHARTW / (ncommits - 1) : CHARTW / 2);
+    y = MARGIN / 2 + CHARTH * (hi - commits[i].m[m]) / (hi - lo);
+    snprintf(label, sizeof(label), charts[c].format, commits[i].m[m]);
+    fprintf(f, "<circle cx=\"%.1f\" cy=\"%.1f\" r=\"4\" class=\"%s\"><title>%s %s: %s %s (%+.2f%%)</title></circle>\n",
+            x, y, d > threshold ? "worse" : d < -threshold ? "better" : "same",
+            commits[i].commit, commits[i].date, label, charts[c].unit, d);
+  }
+  fprintf(f, "</svg>\n");
+}
+
+// Table cell of a metric with its change
+static void cell(FILE *f, int i, int c, double threshold) {
+  int    m = charts[c].index;
+  double d = change(i, m);
+  char   value[32];
+  snprintf(value, sizeof(value), charts[c].format, commits[i].m[m]);
+  fprintf(f, "<td class=\"%s\">%s", d > threshold ? "worse" : d < -threshold ? "better" : "same", value);
+  if(d != 0) fprintf(f, " <small>(%+.2f%%)</small>", d);
+  fprintf(f, "</td>");
+}
+
+// Print usage
+static void usage(void) {
+  fprintf(stderr,
+    "Usage: perfreport [options] history.csv\n"
+    "  -o FILE    HTML output file (default history.html)\n"
+    "  -t PCT     change in percent marked as regression/improvement (default 0.5)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *outfile = "history.html";
+  double      threshold = 0.5;
+  FILE       *f;
+  int         opt, i, c, regressions = 0;
+
+  while((opt = getopt(argc, argv, "o:t:h")) != -1) {
+    switch(opt) {
+      case 'o': outfile   = optarg; break;
+      case 't': threshold = atof(optarg); break;
+      default:  usage();
+    }
+  }
+  if(optind != argc - 1) usage();
+  if(readcsv(argv[optind]) <= 0) {
+    fprintf(stderr, "Error: no commits in %s\n", argv[optind]);
+    return 1;
+  }
+  qsort(commits, ncommits, sizeof(commit_t), cmporder);
+  if(!(f = fopen(outfile, "w"))) {
+    fprintf(stderr, "Error: cannot write %s\n", outfile);
+    return 1;
+  }
+
+  // Page with the charts
+  fprintf(f, "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n");
+  fprintf(f, "<title>TinyCandle Performance History</title>\n<style>\n");
+  fprintf(f, "body { font-family: sans-serif; margin: 20px; }\n");
+  fprintf(f, ".frame { fill: none; stroke: #ccc; }\n.line { fill: none; stroke: #888; }\n");
+  fprintf(f, ".axis { font-size: 11px; text-anchor: end; }\n");
+  fprintf(f, "circle.same { fill: #36c; } circle.worse { fill: #d22; } circle.better { fill: #2a2; }\n");
+  fprintf(f, "td.worse { color: #d22; } td.better { color: #2a2; }\n");
+  fprintf(f, "table { border-collapse: collapse; font-size: 13px; }\n");
+  fprintf(f, "td, th { padding: 2px 8px; border-bottom: 1px solid #eee; text-align: right; }\n");
+  fprintf(f, "td.text { text-align: left; }\n</style>\n</head>\n<body>\n");
+  fprintf(f, "<h1>TinyCandle Performance History</h1>\n");
+  fprintf(f, "<p>%d commits from %s to %s, changes above %.2f%% against the previous commit are marked.</p>\n",
+          ncommits, commits[0].date, commits[ncommits - 1].date, threshold);
+  for(c = 0; c < (int)NCHARTS; c++) chart(f, c, threshold);
+
+  // Table, newest commit first
+  fprintf(f, "<h2>Commits</h2>\n<table>\n<tr><th>commit</th><th>date</th><th>subject</th>");
+  for(c = 0; c < (int)NCHARTS; c++) fprintf(f, "<th>%s (%s)</th>", charts[c].name, charts[c].unit);
+  fprintf(f, "</tr>\n");
+  for(i = ncommits - 1; i >= 0; i--) {
+    fprintf(f, "<tr><td class=\"text\"><code>%s</code></td><td class=\"text\">%s</td><td class=\"text\">",
+            commits[i].commit, commits[i].date);
+    html(f, commits[i].subject);
+    fprintf(f, "</td>");
+    if(!commits[i].built) fprintf(f, "<td colspan=\"%d\" class=\"text\">build failed</td>", (int)NCHARTS);
+    else for(c = 0; c < (int)NCHARTS; c++) {
+      cell(f, i, c, threshold);
+      if(change(i, charts[c].index) > threshold) regressions++;
+    }
+    fprintf(f, "</tr>\n");
+  }
+  fprintf(f, "</table>\n</body>\n</html>\n");
+  fclose(f);
+
+  printf("%d commits, %d regressions above %.2f%% written to %s\n", ncommits, regressions, threshold, outfile);
+  return 0;
+}
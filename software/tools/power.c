@@ -0,0 +1,145 @@
+// ===================================================================================
+// Project:   TinyCandle - Power Model
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "power.h"
+
+// Board v1.0 at 5V USB: yellow LEDs (2.0V), ATtiny13A typical active current
+const power_t power_default = {
+  .board  = "v1.0",
+  .vcc    = 5.0,
+  .vled   = 2.0,
+  .rled   = 220.0,
+  .rpin   = 25.0,
+  .rdson  = 0.1,
+  .rgate  = 11000.0,
+  .imcu0  = 0.10,
+  .imcuf  = 0.55,
+  .iidle0 = 0.02,
+  .iidlef = 0.15,
+  .ipd    = 0.0005,
+  .ipwm   = 0.002,
+  .leds   = 2
+};
+
+// Coefficient names in the board file
+static const struct {
+  const char *name;
+  size_t      offset;
+} keys[] = {
+  {"vcc",    offsetof(power_t, vcc)},    {"vled",   offsetof(power_t, vled)},
+  {"rled",   offsetof(power_t, rled)},   {"rpin",   offsetof(power_t, rpin)},
+  {"rdson",  offsetof(power_t, rdson)},  {"rgate",  offsetof(power_t, rgate)},
+  {"imcu0",  offsetof(power_t, imcu0)},  {"imcuf",  offsetof(power_t, imcuf)},
+  {"iidle0", offsetof(power_t, iidle0)}, {"iidlef", offsetof(power_t, iidlef)},
+  {"ipd",    offsetof(power_t, ipd)},    {"ipwm",   offsetof(power_t, ipwm)}
+};
+#define NKEYS         (sizeof(keys) / sizeof(keys[0]))
+
+// Section header "[board]" of a line, NULL if none
+static const char *section(char *line) {
+  char *end;
+  if(line[0] != '[' || !(end = strchr(line, ']'))) return NULL;
+  *end = 0;
+  return line + 1;
+}
+
+// Coefficients missing in the file keep their default value
+int power_load(power_t *p, const char *filename, const char *board) {
+  FILE *f = fopen(filename, "r");
+  char  line[256], name[32];
+  int   found = 0, in = 0;
+  size_t i;
+
+  if(!f) return -1;
+  *p = power_default;
+  while(fgets(line, sizeof(line), f)) {
+    const char *sec = section(line);
+    double      value;
+    if(sec) {
+      in = !strcmp(sec, board);
+      found |= in;
+      continue;
+    }
+    if(!in || sscanf(line, "%31s %lf", name, &value) != 2) continue;
+    if(!strcmp(name, "leds")) p->leds = (int)value;
+    for(i = 0; i < NKEYS; i++)
+      if(!strcmp(name, keys[i].name)) *(double *)((char *)p + keys[i].offset) = value;
+  }
+  fclose(f);
+  if(!found) return -1;
+  snprintf(p->board, sizeof(p->board), "%s", board);
+  return 0;
+}
+
+// Copy all other sections and append this one
+int power_save(const power_t *p, const char *filename) {
+  FILE  *f = fopen(filename, "r");
+  char  *text = NULL, line[256];
+  size_t len = 0, i;
+  int    skip = 0;
+
+  if(f) {
+    while(fgets(line, sizeof(line), f)) {
+      char        copy[256];
+      const char *sec;
+      strcpy(copy, line);
+      if((sec = section(copy))) skip = !strcmp(sec, p->board);
+      if(skip) continue;
+      text = realloc(text, len + strlen(line) + 1);
+      strcpy(text + len, line);
+      len += strlen(line);
+    }
+    fclose(f);
+  }
+  if(!(f = fopen(filename, "w"))) {
+    free(text);
+    return -1;
+  }
+  if(len) fputs(text, f);
+  if(len && text[len - 1] != '\n') fputc('\n', f);
+  free(text);
+  fprintf(f, "[%s]\n", p->board);
+  for(i = 0; i < NKEYS; i++)
+    fprintf(f, "%-7s %.6g\n", keys[i].name, *(const double *)((const char *)p + keys[i].offset));
+  fprintf(f, "%-7s %d\n\n", "leds", p->leds);
+  return fclose(f) ? -1 : 0;
+}
+
+// LEDs of a pin share the pin resistance and the MOSFET (all four LEDs)
+double power_led(const power_t *p) {
+  double i = (p->vcc - p->vled) / (p->rled + p->leds * p->rpin + 2 * p->leds * p->rdson);
+  return 1000.0 * p->leds * (i > 0 ? i : 0);
+}
+
+// Active current rises linearly with the clock
+double power_mcu(const power_t *p, double fcpu) {
+  return p->imcu0 + p->imcuf * fcpu / 1e6;
+}
+
+// Idle current as well, with the CPU clock stopped
+double power_idle(const power_t *p, double fcpu) {
+  return p->iidle0 + p->iidlef * fcpu / 1e6;
+}
+
+// Gate driven high through the divider of the gate resistors
+double power_gate(const power_t *p) {
+  return 1000.0 * p->vcc / p->rgate;
+}
+
+// MCU, LEDs, gate pull-down of the switched on MOSFET and pin switching
+double power_total(const power_t *p, double fcpu, double dutya, double dutyb, double fpwm) {
+  return power_mcu(p, fcpu)
+       + power_led(p) * (dutya + dutyb)
+       + power_gate(p)
+       + p->ipwm * 2 * fpwm / 1000;
+}
@@ -0,0 +1,70 @@
+// ===================================================================================
+// Project:   TinyCandle - Power Model
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Supply current model of the TinyCandle board: the ATtiny13A running busy (the frame
+// delay is a busy loop), the four LEDs with their 220R resistors driven by PB0/PB1
+// and switched to ground by the SI2302 MOSFET, and the gate resistors of the MOSFET.
+// The built-in coefficients are typical datasheet values of the first board revision.
+// Coefficients fitted to bench measurements by powercal are stored per board revision
+// in a text file (boards.txt) with one section per revision:
+//   [v1.0]
+//   vcc   5.000
+//   ...
+
+#ifndef POWER_H
+#define POWER_H
+
+// Power model coefficients of a board revision
+typedef struct {
+  char   board[16];               // board revision
+  double vcc;                     // supply voltage (V)
+  double vled;                    // LED forward voltage (V)
+  double rled;                    // LED series resistor (Ohm)
+  double rpin;                    // output resistance of a PWM pin (Ohm)
+  double rdson;                   // MOSFET on resistance (Ohm)
+  double rgate;                   // MOSFET gate pull-down resistor (Ohm)
+  double imcu0;                   // MCU active current at 0 Hz (mA)
+  double imcuf;                   // MCU active current per MHz (mA/MHz)
+  double iidle0;                  // MCU idle mode current at 0 Hz (mA)
+  double iidlef;                  // MCU idle mode current per MHz (mA/MHz)
+  double ipd;                     // board current in power-down, MOSFET off (mA)
+  double ipwm;                    // pin switching current per kHz PWM (mA/kHz)
+  int    leds;                    // LEDs per PWM pin
+} power_t;
+
+// Default coefficients
+extern const power_t power_default;
+
+// Default file of the board revisions
+#define POWER_FILE    "boards.txt"
+
+// Load coefficients of board revision from file, returns 0 on success
+int power_load(power_t *p, const char *filename, const char *board);
+
+// Store coefficients as section p->board in file (replacing an existing one)
+int power_save(const power_t *p, const char *filename);
+
+// Current of the LEDs of one PWM pin at full duty (mA)
+double power_led(const power_t *p);
+
+// Current of the MCU in active mode at clock frequency fcpu in Hz (mA)
+double power_mcu(const power_t *p, double fcpu);
+
+// Current of the MCU in idle sleep mode at clock frequency fcpu in Hz (mA)
+double power_idle(const power_t *p, double fcpu);
+
+// Current of the MOSFET gate resistors while the MOSFET is switched on (mA)
+double power_gate(const power_t *p);
+
+// Total supply current (mA) at duty cycles of both PWM pins and PWM frequency
+double power_total(const power_t *p, double fcpu, double dutya, double dutyb, double fpwm);
+
+#endif
@@ -0,0 +1,398 @@
+// ===================================================================================
+// Project:   TinyCandle - Power Model Calibration
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Fits the coefficients of the power model (power.h) to current measurements of a
+// board and stores them as board revision in the board file, so that energyopt and
+// the other tools report calibrated instead of datasheet values. The measurements
+// are CSV files exported from a current probe or a bench multimeter, one sample per
+// line:
+//   state,clock,ocr0a,ocr0b,vcc,current
+// with the firmware state during the capture, the clock in Hz, the fixed values of
+// OCR0A/OCR0B, the supply voltage in V (0 or empty: nominal) and the current in mA:
+//   off    switched off by the button (power-down, MOSFET off)
+//   sleep  power-down of the firmware, which switches the MOSFET off before sleep_mode()
+//   idle   idle sleep mode at clock, MOSFET on, LEDs off
+//   busy   busy loop at clock, MOSFET on, LEDs off
+//   pwm    busy loop at clock with fixed OCR0A/OCR0B (fast PWM, prescaler 1)
+// Lines of other states (e.g. a header) are ignored. Samples with the same settings
+// are averaged. The coefficients are fitted step by step by least squares: power-
+// down current, idle current over the clock together with the gate resistors (from
+// captures at different supply voltages), active current over the clock, and finally
+// LED forward voltage, the series resistance of pin and LED (the 220R resistors and
+// the SI2302 on resistance are taken from the BOM) and the PWM switching current. A
+// coefficient which is not determined by the captures (e.g. the LED forward voltage
+// without captures at different supply voltages) keeps its previous value.
+//
+// Usage:
+// ------
+// powercal [options] FILE.csv...
+//   -b REV     board revision (default v1.0)
+//   -f FILE    file of the board revisions (default boards.txt)
+//   -V VCC     nominal supply voltage in V (default from board file)
+//   -s SCALE   scale of the current column to mA, e.g. 1000 for A (default 1)
+//   -w         store the fitted coefficients in the board file
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "power.h"
+
+// Calibration settings
+#define MAXGROUPS     4096        // different settings in all captures
+#define MINVSPREAD    0.1         // supply voltage range to fit the LED forward voltage
+#define MAXCOLS       3           // unknowns of a least squares fit
+
+// Firmware states of the captures
+enum {STATE_OFF, STATE_SLEEP, STATE_IDLE, STATE_BUSY, STATE_PWM, NSTATES};
+static const char *states[NSTATES] = {"off", "sleep", "idle", "busy", "pwm"};
+
+// Samples with the same settings
+typedef struct {
+  int    state;
+  double clock, vcc;
+  int    ocra, ocrb;
+  double sum, sumsq;
+  long   n;
+} group_t;
+
+static group_t groups[MAXGROUPS];
+static int     ngroups;
+
+// ===================================================================================
+// Import
+// ===================================================================================
+
+// Add sample to the group of its settings
+static int add(int state, double clock, int ocra, int ocrb, double vcc, double current) {
+  group_t *g = NULL;
+  int      i;
+
+  if(state < STATE_IDLE) clock = 0;
+  if(state < STATE_PWM) ocra = ocrb = 0;
+  for(i = 0; i < ngroups; i++) {
+    g = &groups[i];
+    if(g->state == state && g->clock == clock && g->ocra == ocra && g->ocrb == ocrb &&
+       fabs(g->vcc - vcc) < 0.005) break;
+  }
+  if(i == ngroups) {
+    if(ngroups == MAXGROUPS) return -1;
+    g = &groups[ngroups++];
+    memset(g, 0, sizeof(*g));
+    g->state = state;
+    g->clock = clock;
+    g->vcc   = vcc;
+    g->ocra  = ocra;
+    g->ocrb  = ocrb;
+  }
+  g->sum   += current;
+  g->sumsq += current * current;
+  g->n++;
+  return 0;
+}
+
+// Read CSV file, returns number of samples or -1
+static long import(const char *filename, double vnom, double scale) {
+  FILE *f = fopen(filename, "r");
+  char  line[256], name[16];
+  long  n = 0;
+
+  if(!f) return -1;
+  while(fgets(line, sizeof(line), f)) {
+    double clock = 0, vcc = 0, current;
+    int    ocra = 0, ocrb = 0, state;
+    char  *field = strtok(line, ",");
+    if(!field || sscanf(field, " %15s", name) != 1) continue;
+    for(state = 0; state < NSTATES && strcmp(name, states[state]); state++);
+    if(state == NSTATES) continue;
+    if((field = strtok(NULL, ","))) clock = atof(field);
+    if((field = strtok(NULL, ","))) ocra  = atoi(field);
+    if((field = strtok(NULL, ","))) ocrb  = atoi(field);
+    if((field = strtok(NULL, ","))) vcc   = atof(field);
+    if(!(field = strtok(NULL, ","))) continue;
+    current = atof(field) * scale;
+    if(vcc <= 0) vcc = vnom;
+    if(add(state, clock, ocra, ocrb, vcc, current)) break;
+    n++;
+  }
+  fclose(f);
+  return n;
+}
+
+static double mean(const group_t *g) {
+  return g->sum / g->n;
+}
+
+static double stddev(const group_t *g) {
+  double m = mean(g), v = g->sumsq / g->n - m * m;
+  return v > 0 ? sqrt(v) : 0;
+}
+
+// ===================================================================================
+// Fitting
+// ===================================================================================
+
+// Least squares fit of rows x[i][0..k-1] to y[i] by the normal equations, 0 on success
+static int lsq(double (*x)[MAXCOLS], const double *y, int n, int k, double *c) {
+  double a[MAXCOLS][MAXCOLS + 1] = {{0}};
+  int    i, j, r;
+
+  if(n < k) return -1;
+  for(i = 0; i < n; i++)
+    for(j = 0; j < k; j++) {
+      for(r = 0; r < k; r++) a[j][r] += x[i][j] * x[i][r];
+      a[j][k] += x[i][j] * y[i];
+    }
+  for(j = 0; j < k; j++) {
+    int    p = j;
+    double t;
+    for(r = j + 1; r < k; r++) if(fabs(a[r][j]) > fabs(a[p][j])) p = r;
+    if(fabs(a[p][j]) < 1e-12) return -1;
+    for(r = 0; r <= k; r++) {
+      t = a[j][r];
+      a[j][r] = a[p][r];
+      a[p][r] = t;
+    }
+    for(r = 0; r < k; r++) {
+      if(r == j) continue;
+      t = a[r][j] / a[j][j];
+      for(i = j; i <= k; i++) a[r][i] -= t * a[j][i];
+    }
+  }
+  for(j = 0; j < k; j++) c[j] = a[j][k] / a[j][j];
+  return 0;
+}
+
+// Model at the supply voltage of a group
+static power_t at(const power_t *p, const group_t *g) {
+  power_t q = *p;
+  q.vcc = g->vcc;
+  return q;
+}
+
+// Fast PWM duty cycle
+static double duty(int ocr) {
+  return (ocr + 1) / 256.0;
+}
+
+// Modelled current of a group
+static double model(const power_t *p, const group_t *g) {
+  power_t q = at(p, g);
+  switch(g->state) {
+    case STATE_OFF:
+    case STATE_SLEEP: return q.ipd;
+    case STATE_IDLE:  return power_idle(&q, g->clock) + power_gate(&q);
+    case STATE_BUSY:  return power_mcu(&q, g->clock) + power_gate(&q);
+    default:          return power_total(&q, g->clock, duty(g->ocra), duty(g->ocrb), g->clock / 256);
+  }
+}
+
+// Rows of a state, returns number of groups and the range of clock and supply voltage
+static int rows(int state, double *fspread, double *vspread) {
+  double fmin = 1e12, fmax = 0, vmin = 1e12, vmax = 0;
+  int    i, n = 0;
+  for(i = 0; i < ngroups; i++) {
+    if(groups[i].state != state) continue;
+    n++;
+    fmin = fmin < groups[i].clock ? fmin : groups[i].clock;
+    fmax = fmax > groups[i].clock ? fmax : groups[i].clock;
+    vmin = vmin < groups[i].vcc ? vmin : groups[i].vcc;
+    vmax = vmax > groups[i].vcc ? vmax : groups[i].vcc;
+  }
+  *fspread = n ? fmax - fmin : 0;
+  *vspread = n ? vmax - vmin : 0;
+  return n;
+}
+
+// Fit MCU current i0 + if * MHz above the gate current, the slope needs two clocks.
+// With fitgate and captures at different supply voltages, the gate current
+// 1000 * vcc / rgate is fitted as well.
+static void fitmcu(power_t *p, int state, double *i0, double *ifreq, int fitgate) {
+  double (*x)[MAXCOLS] = calloc(ngroups, sizeof(*x));
+  double  *y = calloc(ngroups, sizeof(double)), c[MAXCOLS], fs, vs;
+  int      i, n = 0, k = 0, fitf, fitg;
+
+  if(!rows(state, &fs, &vs)) goto done;
+  fitf = fs > 0;
+  fitg = fitgate && vs >= MINVSPREAD;
+  for(i = 0; i < ngroups; i++) {
+    const group_t *g = &groups[i];
+    power_t        q = at(p, g);
+    if(g->state != state) continue;
+    y[n] = mean(g) - (fitg ? 0 : power_gate(&q)) - (fitf ? 0 : *ifreq * g->clock / 1e6);
+    k = 0;
+    x[n][k++] = 1;
+    if(fitf) x[n][k++] = g->clock / 1e6;
+    if(fitg) x[n][k++] = 1000.0 * g->vcc;
+    n++;
+  }
+  if(lsq(x, y, n, k, c)) goto done;
+  *i0 = c[0];
+  if(fitf) *ifreq = c[1];
+  if(fitg && c[k - 1] > 0) p->rgate = 1 / c[k - 1];
+done:
+  free(x);
+  free(y);
+}
+
+// Fit LED forward voltage, series resistance of pin and LED and switching current
+static void fitleds(power_t *p) {
+  double (*x)[MAXCOLS] = calloc(ngroups, sizeof(*x));
+  double  *y = calloc(ngroups, sizeof(double)), c[MAXCOLS], fs, vs, rtot;
+  int      i, n = 0, k = 0, fitv, fitp;
+
+  if(!rows(STATE_PWM, &fs, &vs)) goto done;
+  fitv = vs >= MINVSPREAD;
+  fitp = fs > 0;
+  // current = a * vcc * d + b * d + ipwm * s, a = 1000 * leds / rtot, b = -a * vled
+  for(i = 0; i < ngroups; i++) {
+    const group_t *g = &groups[i];
+    power_t        q = at(p, g);
+    double         d = duty(g->ocra) + duty(g->ocrb), s = 2 * g->clock / 256 / 1000;
+    if(g->state != STATE_PWM) continue;
+    y[n] = mean(g) - power_mcu(&q, g->clock) - power_gate(&q) - (fitp ? 0 : p->ipwm * s);
+    k = 0;
+    x[n][k++] = (fitv ? g->vcc : g->vcc - p->vled) * d;
+    if(fitv) x[n][k++] = d;
+    if(fitp) x[n][k++] = s;
+    n++;
+  }
+  if(lsq(x, y, n, k, c) || c[0] <= 0) goto done;
+  rtot = 1000.0 * p->leds / c[0];
+  if(fitv) p->vled = -c[1] / c[0];
+  if(fitp) p->ipwm = c[k - 1];
+  p->rpin = (rtot - p->rled - 2 * p->leds * p->rdson) / p->leds;
+done:
+  free(x);
+  free(y);
+}
+
+// Fit all coefficients determined by the captures
+static void fit(power_t *p) {
+  double c = 0;
+  int    i, n = 0;
+
+  // Power-down current, switched off and asleep are the same state of the board
+  for(i = 0; i < ngroups; i++) {
+    if(groups[i].state != STATE_OFF && groups[i].state != STATE_SLEEP) continue;
+    c += mean(&groups[i]);
+    n++;
+  }
+  if(n) p->ipd = c / n;
+
+  // MCU in idle mode with the gate resistors (the only current which depends on the
+  // supply voltage with the LEDs off), in active mode, then the LEDs
+  fitmcu(p, STATE_IDLE, &p->iidle0, &p->iidlef, 1);
+  fitmcu(p, STATE_BUSY, &p->imcu0, &p->imcuf, 0);
+  fitleds(p);
+}
+
+// ===================================================================================
+// Main
+// ===================================================================================
+
+// Print usage
+static void usage(void) {
+  fprintf(stderr,
+    "Usage: powercal [options] FILE.csv...\n"
+    "  -b REV     board revision (default v1.0)\n"
+    "  -f FILE    file of the board revisions (default " POWER_FILE ")\n"
+    "  -V VCC     nominal supply voltage in V (default from board file)\n"
+    "  -s SCALE   scale of the current column to mA, e.g. 1000 for A (default 1)\n"
+    "  -w         store the fitted coefficients in the board file\n"
+    "CSV lines: state,clock,ocr0a,ocr0b,vcc,current (mA)\n"
+    "states:    off, sleep, idle, busy, pwm\n");
+  exit(1);
+}
+
+// Print coefficients before and after the fit
+static void coeff(const char *name, const char *unit, double before, double after) {
+  printf("  %-7s %12.6g %12.6g %-6s%s\n", name, before, after, unit, before != after ? "" : "  (not fitted)");
+}
+
+int main(int argc, char **argv) {
+  const char *rev = "v1.0", *powerfile = POWER_FILE;
+  power_t     prior, p;
+  double      vnom = 0, scale = 1, err2 = 0;
+  long        samples = 0, n;
+  int         opt, i, save = 0;
+
+  while((opt = getopt(argc, argv, "b:f:V:s:wh")) != -1) {
+    switch(opt) {
+      case 'b': rev       = optarg; break;
+      case 'f': powerfile = optarg; break;
+      case 'V': vnom      = atof(optarg); break;
+      case 's': scale     = atof(optarg); break;
+      case 'w': save      = 1; break;
+      default:  usage();
+    }
+  }
+  if(optind >= argc || strlen(rev) >= sizeof(p.board)) usage();
+
+  // Previous coefficients of the board as start values
+  if(power_load(&prior, powerfile, rev)) {
+    prior = power_default;
+    snprintf(prior.board, sizeof(prior.board), "%s", rev);
+    printf("Board %s not found in %s, starting from datasheet values\n", rev, powerfile);
+  }
+  if(vnom > 0) prior.vcc = vnom;
+
+  // Import captures
+  for(i = optind; i < argc; i++) {
+    if((n = import(argv[i], prior.vcc, scale)) < 0) {
+      fprintf(stderr, "Error: cannot read %s\n", argv[i]);
+      return 1;
+    }
+    samples += n;
+  }
+  if(!ngroups) {
+    fprintf(stderr, "Error: no samples\n");
+    return 1;
+  }
+  printf("Imported %ld samples in %d settings from %d files\n", samples, ngroups, argc - optind);
+
+  // Fit and compare with the measurements
+  p = prior;
+  fit(&p);
+  printf("\nstate      clock  OCR0A OCR0B   vcc   samples   measured      stddev     model   error\n");
+  for(i = 0; i < ngroups; i++) {
+    const group_t *g = &groups[i];
+    double         m = model(&p, g), e = (m - mean(g)) / mean(g);
+    err2 += e * e;
+    printf("%-5s %10.0f  %5d %5d %5.2f V %8ld %8.4f mA %8.4f mA %8.4f mA %6.2f%%\n",
+           states[g->state], g->clock, g->ocra, g->ocrb, g->vcc, g->n, mean(g), stddev(g), m, 100 * e);
+  }
+  printf("RMS error %.2f%%\n", 100 * sqrt(err2 / ngroups));
+
+  printf("\nCoefficients of board %s:   previous       fitted\n", p.board);
+  coeff("vled",   "V",      prior.vled,   p.vled);
+  coeff("rpin",   "Ohm",    prior.rpin,   p.rpin);
+  coeff("rgate",  "Ohm",    prior.rgate,  p.rgate);
+  coeff("imcu0",  "mA",     prior.imcu0,  p.imcu0);
+  coeff("imcuf",  "mA/MHz", prior.imcuf,  p.imcuf);
+  coeff("iidle0", "mA",     prior.iidle0, p.iidle0);
+  coeff("iidlef", "mA/MHz", prior.iidlef, p.iidlef);
+  coeff("ipd",    "mA",     prior.ipd,    p.ipd);
+  coeff("ipwm",   "mA/kHz", prior.ipwm,   p.ipwm);
+  printf("  (BOM: rled %.0f Ohm, rdson %.3g Ohm, %d LEDs per pin at %.2f V)\n",
+         p.rled, p.rdson, p.leds, p.vcc);
+  printf("LED current per pin at full duty: %.2f mA\n", power_led(&p));
+
+  if(save) {
+    if(power_save(&p, powerfile)) {
+      fprintf(stderr, "Error: cannot write %s\n", powerfile);
+      return 1;
+    }
+    printf("Stored as board %s in %s\n", p.board, powerfile);
+  }
+  return 0;
+}
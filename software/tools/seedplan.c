@@ -0,0 +1,327 @@
+// ===================================================================================
+// Project:   TinyCandle - LFSR Seed Planner for a Fleet of Candles
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// All candles use the same maximal-length Galois LFSR, so two different seeds only
+// select two time-shifted copies of the same random sequence. This tool assigns the
+// seeds of a fleet of candles so that the phases of their sequences are as far apart
+// as possible: the units are spread evenly over the period of 65535 states, the seeds
+// are calculated by jump-ahead (power of the LFSR step matrix over GF(2)) and the
+// phase of any state by discrete logarithm (phase table of the sequence).
+// Optionally each unit gets its own maximal-length tap polynomial, so the sequences
+// are not related at all. All units are then simulated with the bit-exact host model
+// of the firmware to report how close the phases of any two units drift (the number
+// of random numbers per frame depends on the state of the candle) and the
+// cross-correlation of their brightness.
+//
+// Usage:
+// ------
+// seedplan [options] [seed...]
+//   -n N       number of units of the fleet (default 8)
+//   -t TAPS    LFSR taps (default 0xB400)
+//   -m         different maximal-length taps for every unit
+//   -l         list all maximal-length taps with a zero low byte
+//   -T MIN     simulated time of the correlation report in minutes (default 60)
+//   -w S       window of the correlation in seconds (default 5)
+//   seeds:     print the phase of the given seeds only
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "engine.h"
+
+// Planner settings
+#define PERIOD        65535       // period of a maximal-length 16-bit LFSR
+#define FPS           63.1        // frame rate of the firmware as shipped
+#define MAXUNITS      64
+#define MAXTAPS       256
+
+// LFSR steps per frame (measured)
+static double stepsframe;
+
+// 16x16 matrix over GF(2), column j is the image of bit j
+typedef struct {
+  uint16_t col[16];
+} gf2mat_t;
+
+// Phase tables (discrete logarithm) of the used taps
+typedef struct {
+  uint16_t taps;
+  uint16_t phase[65536];          // phase of state relative to LFSRSEED
+} phasetab_t;
+
+// ===================================================================================
+// LFSR Arithmetic
+// ===================================================================================
+
+// One step of the Galois LFSR (prng() of the firmware)
+static uint16_t lfsr_step(uint16_t s, uint16_t taps) {
+  return (s >> 1) ^ (-(s & 1) & taps);
+}
+
+// Matrix times vector
+static uint16_t gf2_apply(const gf2mat_t *m, uint16_t v) {
+  uint16_t r = 0;
+  int      j;
+  for(j = 0; j < 16; j++) if(v & (1 << j)) r ^= m->col[j];
+  return r;
+}
+
+// Matrix product a * b
+static gf2mat_t gf2_mul(const gf2mat_t *a, const gf2mat_t *b) {
+  gf2mat_t r;
+  int      j;
+  for(j = 0; j < 16; j++) r.col[j] = gf2_apply(a, b->col[j]);
+  return r;
+}
+
+// Step matrix of the LFSR raised to the power n
+static gf2mat_t lfsr_matrix(uint16_t taps, uint32_t n) {
+  gf2mat_t m, r;
+  int      j;
+  for(j = 0; j < 16; j++) {
+    m.col[j] = lfsr_step(1 << j, taps);
+    r.col[j] = 1 << j;
+  }
+  for(; n; n >>= 1) {
+    if(n & 1) r = gf2_mul(&r, &m);
+    m = gf2_mul(&m, &m);
+  }
+  return r;
+}
+
+// Jump ahead n steps
+static uint16_t lfsr_jump(uint16_t s, uint16_t taps, uint32_t n) {
+  gf2mat_t m = lfsr_matrix(taps, n % PERIOD);
+  return gf2_apply(&m, s);
+}
+
+// Identity matrix test
+static int gf2_identity(const gf2mat_t *m) {
+  int j;
+  for(j = 0; j < 16; j++) if(m->col[j] != (1 << j)) return 0;
+  return 1;
+}
+
+// Maximal length: M^65535 = I and M^(65535/p) != I for the prime factors 3, 5, 17, 257
+static int lfsr_maximal(uint16_t taps) {
+  static const uint32_t primes[] = {3, 5, 17, 257};
+  gf2mat_t m = lfsr_matrix(taps, PERIOD);
+  size_t   i;
+  if(!(taps & 0x8000) || !gf2_identity(&m)) return 0;
+  for(i = 0; i < sizeof(primes) / sizeof(primes[0]); i++) {
+    m = lfsr_matrix(taps, PERIOD / primes[i]);
+    if(gf2_identity(&m)) return 0;
+  }
+  return 1;
+}
+
+// Build phase table (discrete logarithm relative to LFSRSEED)
+static void lfsr_phases(phasetab_t *t, uint16_t taps) {
+  uint16_t s = LFSRSEED;
+  uint32_t n;
+  t->taps     = taps;
+  t->phase[0] = 0;
+  for(n = 0; n < PERIOD; n++) {
+    t->phase[s] = n;
+    s = lfsr_step(s, taps);
+  }
+}
+
+// Mean number of LFSR steps per frame of the firmware
+static double steps_per_frame(const phasetab_t *t) {
+  candle_t c;
+  uint32_t steps = 0, last = 0;
+  int      f;
+  candle_init(&c, ENGINE_SPRING, 0);
+  c.taps = t->taps;
+  for(f = 0; f < 65536; f++) {
+    candle_update(&c);
+    steps += (t->phase[c.rn] + PERIOD - last) % PERIOD;
+    last   = t->phase[c.rn];
+  }
+  return steps / 65536.0;
+}
+
+// Phase distance on the cycle
+static uint32_t phasedist(uint32_t a, uint32_t b) {
+  uint32_t d = (a > b) ? a - b : b - a;
+  return (d > PERIOD / 2) ? PERIOD - d : d;
+}
+
+// ===================================================================================
+// Correlation Report
+// ===================================================================================
+
+// Pearson correlation of two byte sequences
+static double correlation(const uint8_t *a, const uint8_t *b, int n) {
+  double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0, va, vb;
+  int    i;
+  for(i = 0; i < n; i++) {
+    sa  += a[i];
+    sb  += b[i];
+    saa += a[i] * a[i];
+    sbb += b[i] * b[i];
+    sab += a[i] * b[i];
+  }
+  va = saa - sa * sa / n;
+  vb = sbb - sb * sb / n;
+  if(va <= 0 || vb <= 0) return 0;
+  return (sab - sa * sb / n) / sqrt(va * vb);
+}
+
+// Simulate all units and report phase drift and brightness correlation of all pairs
+static void report(int units, const uint16_t *taps, const uint16_t *seeds,
+                   const phasetab_t *tab, double minutes, double window) {
+  int       frames = minutes * 60 * FPS, win = window * FPS, i, j, f;
+  uint8_t  *ocr   = malloc((size_t)units * frames);
+  uint16_t *phase = malloc((size_t)units * frames * sizeof(uint16_t));
+  double    worst = 0;
+  candle_t  c;
+
+  if(!ocr || !phase) {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  for(i = 0; i < units; i++) {
+    candle_init(&c, ENGINE_SPRING, seeds[i]);
+    c.taps = taps[i];
+    for(f = 0; f < frames; f++) {
+      candle_update(&c);
+      ocr[(size_t)i * frames + f]   = c.ocra;
+      phase[(size_t)i * frames + f] = (taps[i] == tab->taps) ? tab->phase[c.rn] : 0;
+    }
+  }
+
+  printf("\nCorrelation report (%.0f minutes, %.0f s windows):\n", minutes, window);
+  printf("  unit  unit  min.sep   sep.time   corr  max.win.corr  time>0.5\n");
+  for(i = 0; i < units; i++)
+    for(j = i + 1; j < units; j++) {
+      const uint8_t *a = ocr + (size_t)i * frames, *b = ocr + (size_t)j * frames;
+      double   corr = correlation(a, b, frames), maxwin = 0;
+      uint32_t minsep = PERIOD;
+      int      nwin = 0, high = 0;
+
+      if(taps[i] == taps[j] && taps[i] == tab->taps)
+        for(f = 0; f < frames; f++) {
+          uint32_t d = phasedist(phase[(size_t)i * frames + f], phase[(size_t)j * frames + f]);
+          if(d < minsep) minsep = d;
+        }
+      for(f = 0; f + win <= frames; f += win) {
+        double w = correlation(a + f, b + f, win);
+        if(w > maxwin) maxwin = w;
+        high += (w > 0.5);
+        nwin++;
+      }
+      if(maxwin > worst) worst = maxwin;
+      if(minsep < PERIOD)
+        printf("  %4d  %4d  %7u  %7.1f s  %5.2f  %12.2f  %7.1f%%\n", i + 1, j + 1, minsep,
+               minsep / stepsframe / FPS, corr, maxwin, 100.0 * high / (nwin ? nwin : 1));
+      else
+        printf("  %4d  %4d        -          -  %5.2f  %12.2f  %7.1f%%\n", i + 1, j + 1,
+               corr, maxwin, 100.0 * high / (nwin ? nwin : 1));
+    }
+  printf("  worst windowed correlation: %.2f\n", worst);
+  printf("  (sep.time at %.2f random numbers per frame and %.1f fps)\n", stepsframe, FPS);
+  free(ocr);
+  free(phase);
+}
+
+// ===================================================================================
+// Main
+// ===================================================================================
+
+// Print usage
+static void usage(void) {
+  fprintf(stderr,
+    "Usage: seedplan [options] [seed...]\n"
+    "  -n N       number of units of the fleet (default 8)\n"
+    "  -t TAPS    LFSR taps (default 0xB400)\n"
+    "  -m         different maximal-length taps for every unit\n"
+    "  -l         list all maximal-length taps with a zero low byte\n"
+    "  -T MIN     simulated time of the correlation report in minutes (default 60)\n"
+    "  -w S       window of the correlation in seconds (default 5)\n"
+    "  seeds:     print the phase of the given seeds only\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static phasetab_t tab;
+  uint16_t taps = LFSRTAPS, alltaps[MAXTAPS], unittaps[MAXUNITS], seeds[MAXUNITS];
+  double   minutes = 60, window = 5;
+  int      units = 8, multi = 0, list = 0, ntaps = 0, opt, i;
+  uint32_t t, sep;
+
+  while((opt = getopt(argc, argv, "n:t:mlT:w:h")) != -1) {
+    switch(opt) {
+      case 'n': units   = atoi(optarg); break;
+      case 't': taps    = strtoul(optarg, NULL, 0); break;
+      case 'm': multi   = 1; break;
+      case 'l': list    = 1; break;
+      case 'T': minutes = atof(optarg); break;
+      case 'w': window  = atof(optarg); break;
+      default:  usage();
+    }
+  }
+  if(units < 1 || units > MAXUNITS || minutes <= 0 || window <= 0) usage();
+  if(!lfsr_maximal(taps)) {
+    fprintf(stderr, "Error: taps 0x%04X are not maximal-length\n", taps);
+    return 1;
+  }
+  lfsr_phases(&tab, taps);
+  stepsframe = steps_per_frame(&tab);
+
+  // Phases of given seeds
+  if(optind < argc) {
+    for(i = optind; i < argc; i++) {
+      uint16_t s = strtoul(argv[i], NULL, 0);
+      if(!s) printf("seed 0x0000: invalid (LFSR stays zero)\n");
+      else   printf("seed 0x%04X: phase %5u (taps 0x%04X, relative to 0x%04X)\n", s, tab.phase[s], taps, LFSRSEED);
+    }
+    return 0;
+  }
+
+  // Maximal-length taps with zero low byte (LFSR step in 5 instructions, see superopt)
+  if(list || multi) {
+    alltaps[ntaps++] = taps;
+    for(t = 0x8000; t <= 0xFF00 && ntaps < MAXTAPS; t += 0x100)
+      if(t != taps && lfsr_maximal(t)) alltaps[ntaps++] = t;
+    if(list) {
+      printf("Maximal-length taps with zero low byte:");
+      for(i = 0; i < ntaps; i++) printf("%s0x%04X", (i % 8) ? " " : "\n  ", alltaps[i]);
+      printf("\n");
+      return 0;
+    }
+  }
+
+  // Seeds: units evenly spread over the period, distinct taps first if requested
+  printf("Seed plan for %d units:\n", units);
+  printf("  unit  taps    seed    phase   separation\n");
+  for(i = 0; i < units; i++) {
+    int group = multi ? ntaps : 1;               // units per taps: ceil(units / group)
+    int index = i / group, count = (units - i % group + group - 1) / group;
+    unittaps[i] = multi ? alltaps[i % ntaps] : taps;
+    sep      = PERIOD / count;
+    seeds[i] = lfsr_jump(LFSRSEED, unittaps[i], (uint32_t)index * sep);
+    printf("  %4d  0x%04X  0x%04X  %5u   %5u steps (%.0f s)\n", i + 1, unittaps[i], seeds[i],
+           index * sep, sep, sep / stepsframe / FPS);
+  }
+
+  // Settings
+  printf("\nSettings of the units (config.h):\n");
+  for(i = 0; i < units; i++)
+    printf("  unit %2d:  #define LFSRSEED      0x%04X   #define LFSRTAPS      0x%04X\n",
+           i + 1, seeds[i], unittaps[i]);
+
+  report(units, unittaps, seeds, &tab, minutes, window);
+  return 0;
+}
@@ -0,0 +1,88 @@
+// ===================================================================================
+// Project:   TinyCandle - Spectral Analysis
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spectrum.h"
+
+// In-place iterative radix-2 FFT
+void fft(double *re, double *im, int n) {
+  int i, j, k, len;
+  for(i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for(; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if(i < j) {
+      double t;
+      t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+  for(len = 2; len <= n; len <<= 1) {
+    double ang = -2 * M_PI / len;
+    double wr  = cos(ang), wi = sin(ang);
+    for(i = 0; i < n; i += len) {
+      double cr = 1, ci = 0;
+      for(k = 0; k < len / 2; k++) {
+        int    a  = i + k, b = i + k + len / 2;
+        double tr = re[b] * cr - im[b] * ci;
+        double ti = re[b] * ci + im[b] * cr;
+        double nr;
+        re[b] = re[a] - tr;  im[b] = im[a] - ti;
+        re[a] += tr;         im[a] += ti;
+        nr = cr * wr - ci * wi;
+        ci = cr * wi + ci * wr;
+        cr = nr;
+      }
+    }
+  }
+}
+
+// Welch PSD estimate (mean removed per segment)
+int psd_welch(const double *x, size_t len, int n, double *psd) {
+  double *re  = malloc(n * sizeof(double));
+  double *im  = malloc(n * sizeof(double));
+  double *win = malloc(n * sizeof(double));
+  double  wsum = 0;
+  size_t  pos;
+  int     i, segs = 0;
+
+  memset(psd, 0, (n / 2 + 1) * sizeof(double));
+  for(i = 0; i < n; i++) {
+    win[i] = 0.5 - 0.5 * cos(2 * M_PI * i / n);
+    wsum  += win[i] * win[i];
+  }
+  for(pos = 0; pos + n <= len; pos += n / 2) {
+    double mean = 0;
+    for(i = 0; i < n; i++) mean += x[pos + i];
+    mean /= n;
+    for(i = 0; i < n; i++) {
+      re[i] = (x[pos + i] - mean) * win[i];
+      im[i] = 0;
+    }
+    fft(re, im, n);
+    for(i = 0; i <= n / 2; i++) psd[i] += (re[i] * re[i] + im[i] * im[i]) / wsum;
+    segs++;
+  }
+  if(segs) for(i = 0; i <= n / 2; i++) psd[i] /= segs;
+  free(re);
+  free(im);
+  free(win);
+  return segs;
+}
+
+// Linear interpolation between PSD bins
+double psd_at(const double *psd, int n, double rate, double f) {
+  double pos = f * n / rate;
+  int    k   = (int)pos;
+  if(k < 0) return psd[0];
+  if(k >= n / 2) return psd[n / 2];
+  return psd[k] + (psd[k + 1] - psd[k]) * (pos - k);
+}
@@ -0,0 +1,30 @@
+// ===================================================================================
+// Project:   TinyCandle - Spectral Analysis
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Radix-2 FFT and Welch power spectral density estimate for the flicker analysis of
+// the host tools.
+
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <stddef.h>
+
+// In-place complex FFT, n must be a power of two
+void fft(double *re, double *im, int n);
+
+// Welch PSD with Hann window and 50% overlap, segment length n (power of two).
+// Writes n/2 + 1 bins (bin k at k * rate / n), returns number of segments averaged.
+int  psd_welch(const double *x, size_t len, int n, double *psd);
+
+// Interpolate a PSD given at bin frequencies (n/2 + 1 bins) at frequency f
+double psd_at(const double *psd, int n, double rate, double f);
+
+#endif
@@ -0,0 +1,698 @@
+// ===================================================================================
+// Project:   TinyCandle - Superoptimizer for the Candle Kernels
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Searches the shortest AVR instruction sequences for the tiny hot kernels of the
+// candle simulation: the LFSR step of prng(), the clamping to +-MAXDEV, the 128 + x
+// output conversion and the velocity damping. Sequences are enumerated breadth first
+// by length in words from an alphabet of ALU, immediate, conditional (branch over one
+// instruction) and skip instructions on the kernel registers. Sequences leading to
+// identical machine states on a set of test inputs are pruned, so all sequences up
+// to the pruned state count are covered exhaustively. Beyond that a beam of the
+// states closest to the kernel output is kept. Every candidate passing the test
+// inputs is verified on the ATtiny13A simulator for all 65536 inputs with random
+// scratch register and status register contents. The shortest verified sequence is
+// compared to the avr-gcc code of the shipped firmware and printed as inline
+// assembly.
+//
+// Usage:
+// ------
+// superopt [options] [kernel...]
+//   -l N       maximum sequence length in words (default 6)
+//   -b N       maximum number of states per length (beam width, default 20000)
+//   -a         print all verified sequences of the shortest length
+//   kernels: lfsr, clamp, output, damping (default all)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "avrsim.h"
+
+// Search settings
+#define NTEST         12          // test inputs for pruning
+#define NREG          3           // searched registers: r24, r25, r18
+#define MAXALPHA      4096        // maximum alphabet size
+#define MAXLEN        10          // maximum sequence length in words
+#define HASHBITS      22          // size of state hash table
+#define MAXTRIES      4096        // candidates verified on the simulator per kernel
+
+// Registers of the search state
+static const uint8_t regnum[NREG] = {24, 25, 18};
+#define R_LO          0
+#define R_HI          1
+#define R_TMP         2
+#define R_ZERO        3           // r1, always zero (avr-gcc __zero_reg__)
+
+// Status register flags used by the search
+#define F_C           0x01
+#define F_Z           0x02
+#define F_N           0x04
+#define F_V           0x08
+#define F_S           0x10
+
+// ===================================================================================
+// Instructions
+// ===================================================================================
+
+// Operation codes
+enum {
+  OP_ADD, OP_ADC, OP_SUB, OP_SBC, OP_AND, OP_OR, OP_EOR, OP_MOV, OP_CP, OP_CPC,
+  OP_COM, OP_NEG, OP_INC, OP_DEC, OP_LSR, OP_ROR, OP_ASR, OP_SWAP,
+  OP_LDI, OP_ANDI, OP_ORI, OP_SUBI, OP_SBCI, OP_CPI,
+  OP_COUNT
+};
+
+static const char *mnemonic[OP_COUNT] = {
+  "add", "adc", "sub", "sbc", "and", "or", "eor", "mov", "cp", "cpc",
+  "com", "neg", "inc", "dec", "lsr", "ror", "asr", "swap",
+  "ldi", "andi", "ori", "subi", "sbci", "cpi"
+};
+
+// Conditions: branch over the next instruction (brxx .+2) or skip if bit (sbrc/sbrs)
+enum { C_NONE, C_BRCC, C_BRCS, C_BRNE, C_BREQ, C_BRPL, C_BRMI, C_BRGE, C_BRLT, C_SBRC, C_SBRS };
+static const char *condname[] = {
+  "", "brcc", "brcs", "brne", "breq", "brpl", "brmi", "brge", "brlt", "sbrc", "sbrs"
+};
+
+// Instruction (optionally conditional): op d, r/K
+typedef struct {
+  uint8_t cond, creg, cbit;       // condition, register and bit for sbrc/sbrs
+  uint8_t op, d, r;               // r is a register index or the immediate value
+} insn_t;
+
+// One test machine state
+typedef struct {
+  uint8_t reg[NREG];
+  uint8_t sreg;
+} mstate_t;
+
+// Search node: machine states for all test inputs
+typedef struct {
+  mstate_t st[NTEST];
+  int32_t  parent;
+  uint16_t insn;
+  uint8_t  len;
+  uint8_t  score;
+} node_t;
+
+// ===================================================================================
+// Kernels
+// ===================================================================================
+
+typedef struct {
+  const char    *name;
+  const char    *desc;
+  uint16_t     (*spec)(uint16_t x);
+  uint8_t        outbytes;        // 1: result in r24, 2: result in r25:r24
+  const uint8_t *consts;
+  int            nconsts;
+  const uint16_t *ref;            // avr-gcc code of the shipped firmware
+  int            nref;
+  uint8_t        refin[2];        // input registers of the reference code
+  uint8_t        refout[2];       // output registers of the reference code
+  uint8_t        refconst[8];     // reference code register constants (reg, value)
+} kernel_t;
+
+static uint16_t spec_lfsr(uint16_t x) {
+  return (x >> 1) ^ (-(x & 1) & 0xB400);
+}
+
+static uint16_t spec_clamp(uint16_t x) {
+  int16_t v = (int16_t)x;
+  if(v < -100) v = -100;
+  if(v >  100) v =  100;
+  return (uint16_t)v;
+}
+
+static uint16_t spec_output(uint16_t x) {
+  return (uint8_t)(128 + x);
+}
+
+static uint16_t spec_damping(uint16_t x) {
+  return (uint16_t)((int16_t)((int16_t)x * 999) / 1000);
+}
+
+// Constants of the kernels
+static const uint8_t c_lfsr[]    = {0x00, 0x01, 0xB4, 0xFF};
+static const uint8_t c_clamp[]   = {0x00, 0x64, 0x65, 0x9B, 0x9C, 0xFF};
+static const uint8_t c_output[]  = {0x80};
+static const uint8_t c_damping[] = {0x00, 0x01, 0x03, 0xE7, 0xE8, 0xFF};
+
+// avr-gcc code of the shipped firmware (register part, loads and stores removed)
+static const uint16_t r_lfsr[] = {        // in r19:r18, out r25:r24
+  0x01C9,   // movw r24, r18
+  0x7081,   // andi r24, 0x01
+  0x2799,   // eor  r25, r25
+  0x9591,   // neg  r25
+  0x9581,   // neg  r24
+  0x0991,   // sbc  r25, r1
+  0x2788,   // eor  r24, r24
+  0x7B94,   // andi r25, 0xB4
+  0x9536,   // lsr  r19
+  0x9527,   // ror  r18
+  0x2782,   // eor  r24, r18
+  0x2793    // eor  r25, r19
+};
+static const uint16_t r_clamp[] = {       // in/out r25:r24, r15:r14 = -100, r13:r12 = 100 (stores as moves)
+  0x398C,   // cpi  r24, 0x9C
+  0x059F,   // cpc  r25, r15
+  0xF414,   // brge .+4
+  0x2D8E,   // mov  r24, r14
+  0x2D9F,   // mov  r25, r15
+  0x3685,   // cpi  r24, 0x65
+  0x0591,   // cpc  r25, r1
+  0xF014,   // brlt .+4
+  0x2D8C,   // mov  r24, r12
+  0x2D9D    // mov  r25, r13
+};
+static const uint16_t r_output[] = {      // in r24, out r24
+  0x5880    // subi r24, 0x80
+};
+
+// Velocity damping calls __mulhi3 and __divmodhi4 of libgcc, see damping_ref()
+static const uint16_t r_damping[] = {     // in r25:r24, out r23:r22
+  0xEE67,   // ldi   r22, 0xE7
+  0xE073,   // ldi   r23, 0x03
+  0xD000,   // rcall __mulhi3 (patched)
+  0xEE68,   // ldi   r22, 0xE8
+  0xE073,   // ldi   r23, 0x03
+  0xD000    // rcall __divmodhi4 (patched)
+};
+
+// libgcc __mulhi3, __udivmodhi4 and __divmodhi4 as linked into the shipped firmware
+static const uint16_t libgcc[] = {
+  0x2400, 0x2755, 0xC004, 0x0E08, 0x1F59, 0x0F88, 0x1F99, 0x9700, 0xF029, 0x9576,
+  0x9567, 0xF3B8, 0x0571, 0xF7B9, 0x2D80, 0x2F95, 0x9508,
+  0x1BAA, 0x1BBB, 0xE151, 0xC007, 0x1FAA, 0x1FBB, 0x17A6, 0x07B7, 0xF010, 0x1BA6,
+  0x0BB7, 0x1F88, 0x1F99, 0x955A, 0xF7A9, 0x9580, 0x9590, 0x01BC, 0x01CD, 0x9508,
+  0xFB97, 0x2E07, 0xF416, 0x9400, 0xD006, 0xFD77, 0xD008, 0xDFE4, 0xFC07, 0xD005,
+  0xF43E, 0x9590, 0x9581, 0x4F9F, 0x9508, 0x9570, 0x9561, 0x4F7F, 0x9508
+};
+#define LIB_MULHI3    0
+#define LIB_DIVMODHI4 37
+
+static kernel_t kernels[] = {
+  {"lfsr",    "LFSR step of prng(): x = (x >> 1) ^ (-(x & 1) & 0xB400)", spec_lfsr, 2,
+   c_lfsr, sizeof(c_lfsr), r_lfsr, 12, {18, 19}, {24, 25}, {0}},
+  {"clamp",   "range limit: x = max(-MAXDEV, min(MAXDEV, x))", spec_clamp, 2,
+   c_clamp, sizeof(c_clamp), r_clamp, 10, {24, 25}, {24, 25}, {14, 0x9C, 15, 0xFF, 12, 0x64, 13, 0x00}},
+  {"output",  "PWM output: OCR0x = 128 + x", spec_output, 1,
+   c_output, sizeof(c_output), r_output, 1, {24, 25}, {24, 0}, {0}},
+  {"damping", "velocity damping: x = (x * 999) / 1000 (16-bit int)", spec_damping, 2,
+   c_damping, sizeof(c_damping), r_damping, 6, {24, 25}, {22, 23}, {0}}
+};
+#define NKERNELS      (sizeof(kernels) / sizeof(kernels[0]))
+
+// ===================================================================================
+// Interpreter for the Search
+// ===================================================================================
+
+// Flags of 8-bit addition and subtraction
+static uint8_t fl_add(uint8_t d, uint8_t r, uint8_t res) {
+  uint8_t c = (d & r) | (r & ~res) | (~res & d);
+  uint8_t v = (d & r & ~res) | (~d & ~r & res);
+  uint8_t f = ((c >> 7) & 1) * F_C | (!res) * F_Z | ((res >> 7) & 1) * F_N | ((v >> 7) & 1) * F_V;
+  return f | ((!!(f & F_N)) ^ (!!(f & F_V))) * F_S;
+}
+
+static uint8_t fl_sub(uint8_t d, uint8_t r, uint8_t res, uint8_t oldz, int keepz) {
+  uint8_t c = (~d & r) | (r & res) | (res & ~d);
+  uint8_t v = (d & ~r & ~res) | (~d & r & res);
+  uint8_t z = keepz ? (!res && oldz) : !res;
+  uint8_t f = ((c >> 7) & 1) * F_C | z * F_Z | ((res >> 7) & 1) * F_N | ((v >> 7) & 1) * F_V;
+  return f | ((!!(f & F_N)) ^ (!!(f & F_V))) * F_S;
+}
+
+static uint8_t fl_logic(uint8_t res, uint8_t old) {
+  return (old & F_C) | (!res) * F_Z | ((res >> 7) & 1) * (F_N | F_S);
+}
+
+static uint8_t fl_shift(uint8_t res, uint8_t c) {
+  uint8_t n = (res >> 7) & 1;
+  return c * F_C | (!res) * F_Z | n * F_N | (n ^ c) * F_V | c * F_S;
+}
+
+// Execute unconditional part, returns cycles
+static int exec_op(const insn_t *in, mstate_t *s) {
+  uint8_t *d  = &s->reg[in->d];
+  uint8_t  rv = (in->op >= OP_LDI) ? in->r : (in->r == R_ZERO ? 0 : s->reg[in->r]);
+  uint8_t  c  = s->sreg & F_C, z = !!(s->sreg & F_Z), res;
+  switch(in->op) {
+    case OP_ADD:  res = *d + rv;     s->sreg = fl_add(*d, rv, res); *d = res; break;
+    case OP_ADC:  res = *d + rv + c; s->sreg = fl_add(*d, rv, res); *d = res; break;
+    case OP_SUB:
+    case OP_SUBI: res = *d - rv;     s->sreg = fl_sub(*d, rv, res, z, 0); *d = res; break;
+    case OP_SBC:
+    case OP_SBCI: res = *d - rv - c; s->sreg = fl_sub(*d, rv, res, z, 1); *d = res; break;
+    case OP_CP:
+    case OP_CPI:  res = *d - rv;     s->sreg = fl_sub(*d, rv, res, z, 0); break;
+    case OP_CPC:  res = *d - rv - c; s->sreg = fl_sub(*d, rv, res, z, 1); break;
+    case OP_AND:
+    case OP_ANDI: *d &= rv; s->sreg = fl_logic(*d, s->sreg); break;
+    case OP_OR:
+    case OP_ORI:  *d |= rv; s->sreg = fl_logic(*d, s->sreg); break;
+    case OP_EOR:  *d ^= rv; s->sreg = fl_logic(*d, s->sreg); break;
+    case OP_MOV:
+    case OP_LDI:  *d = rv; break;
+    case OP_COM:  *d = ~*d; s->sreg = fl_logic(*d, s->sreg) | F_C; break;
+    case OP_NEG:  res = -*d; s->sreg = fl_sub(0, *d, res, z, 0); *d = res; break;
+    case OP_INC:
+    case OP_DEC:
+      res = *d + (in->op == OP_INC ? 1 : -1);
+      s->sreg = (s->sreg & F_C) | (!res) * F_Z | ((res >> 7) & 1) * F_N
+              | (res == (in->op == OP_INC ? 0x80 : 0x7F)) * F_V;
+      s->sreg |= ((!!(s->sreg & F_N)) ^ (!!(s->sreg & F_V))) * F_S;
+      *d = res;
+      break;
+    case OP_LSR:  res = *d >> 1; s->sreg = fl_shift(res, *d & 1); *d = res; break;
+    case OP_ROR:  res = (c << 7) | (*d >> 1); s->sreg = fl_shift(res, *d & 1); *d = res; break;
+    case OP_ASR:  res = (*d & 0x80) | (*d >> 1); s->sreg = fl_shift(res, *d & 1); *d = res; break;
+    case OP_SWAP: *d = (*d << 4) | (*d >> 4); break;
+  }
+  return 1;
+}
+
+// Execute instruction with condition, returns cycles
+static int exec(const insn_t *in, mstate_t *s) {
+  int skip;
+  switch(in->cond) {
+    case C_NONE: return exec_op(in, s);
+    case C_BRCC: skip = !(s->sreg & F_C); break;
+    case C_BRCS: skip = !!(s->sreg & F_C); break;
+    case C_BRNE: skip = !(s->sreg & F_Z); break;
+    case C_BREQ: skip = !!(s->sreg & F_Z); break;
+    case C_BRPL: skip = !(s->sreg & F_N); break;
+    case C_BRMI: skip = !!(s->sreg & F_N); break;
+    case C_BRGE: skip = !(s->sreg & F_S); break;
+    case C_BRLT: skip = !!(s->sreg & F_S); break;
+    case C_SBRC: skip = !((s->reg[in->creg] >> in->cbit) & 1); break;
+    default:     skip = (s->reg[in->creg] >> in->cbit) & 1; break;
+  }
+  if(skip) return 2;
+  return 1 + exec_op(in, s);
+}
+
+// Instruction length in words
+static int insnlen(const insn_t *in) {
+  return in->cond ? 2 : 1;
+}
+
+// ===================================================================================
+// Encoding and Printing
+// ===================================================================================
+
+// Encode instruction to AVR opcodes, returns number of words
+static int encode(const insn_t *in, uint16_t *w) {
+  static const uint16_t rr[] = {0x0C00, 0x1C00, 0x1800, 0x0800, 0x2000, 0x2800, 0x2400, 0x2C00, 0x1400, 0x0400};
+  static const uint16_t r1[] = {0x9400, 0x9401, 0x9403, 0x940A, 0x9406, 0x9407, 0x9405, 0x9402};
+  static const uint16_t ri[] = {0xE000, 0x7000, 0x6000, 0x5000, 0x4000, 0x3000};
+  static const uint16_t br[] = {0, 0xF400, 0xF000, 0xF401, 0xF001, 0xF402, 0xF002, 0xF404, 0xF004};
+  uint8_t  d = regnum[in->d];
+  uint16_t op;
+  int      n = 0;
+
+  if(in->cond >= C_SBRC) w[n++] = (in->cond == C_SBRC ? 0xFC00 : 0xFE00) | (regnum[in->creg] << 4) | in->cbit;
+  else if(in->cond)      w[n++] = br[in->cond] | (1 << 3);
+  if(in->op <= OP_CPC) {
+    uint8_t r = (in->r == R_ZERO) ? 1 : regnum[in->r];
+    op = rr[in->op] | ((r & 0x10) << 5) | (d << 4) | (r & 0x0F);
+  } else if(in->op <= OP_SWAP) op = r1[in->op - OP_COM] | (d << 4);
+  else op = ri[in->op - OP_LDI] | ((in->r & 0xF0) << 4) | ((d - 16) << 4) | (in->r & 0x0F);
+  w[n++] = op;
+  return n;
+}
+
+// Print instruction, inl selects inline assembly operands (r25:r24 = %B0:%A0, r18 = %1)
+static void print_insn(FILE *f, const insn_t *in, int inl) {
+  static const char *plain[] = {"r24", "r25", "r18", "r1"};
+  static const char *opnd[]  = {"%A0", "%B0", "%1", "__zero_reg__"};
+  const char **rn = inl ? opnd : plain;
+  char ops[64], cond[64] = "";
+
+  if(in->op >= OP_LDI)      snprintf(ops, sizeof(ops), "%-4s %s, 0x%02X", mnemonic[in->op], rn[in->d], in->r);
+  else if(in->op >= OP_COM) snprintf(ops, sizeof(ops), "%-4s %s", mnemonic[in->op], rn[in->d]);
+  else                      snprintf(ops, sizeof(ops), "%-4s %s, %s", mnemonic[in->op], rn[in->d], rn[in->r]);
+  if(in->cond >= C_SBRC) snprintf(cond, sizeof(cond), "%s %s, %d", condname[in->cond], rn[in->creg], in->cbit);
+  else if(in->cond)      snprintf(cond, sizeof(cond), "%-4s %s", condname[in->cond], inl ? "1f" : ".+2");
+
+  if(!inl) {
+    if(in->cond) fprintf(f, "    %s\n", cond);
+    fprintf(f, "    %s\n", ops);
+    return;
+  }
+  if(in->cond) fprintf(f, "    \"%-20s\\n\\t\"\n", cond);
+  fprintf(f, "    \"%-20s\\n\\t\"\n", ops);
+  if(in->cond && in->cond < C_SBRC) fprintf(f, "    \"%-20s\\n\\t\"\n", "1:");
+}
+
+// ===================================================================================
+// Verification on the Simulator
+// ===================================================================================
+
+typedef struct {
+  int    words;
+  int    minc, maxc;
+  double avgc;
+} cost_t;
+
+// Run code on the simulator for all inputs, returns 0 if equivalent to the spec
+static int verify(const kernel_t *k, const uint16_t *code, int words, const uint8_t *in,
+                  const uint8_t *out, const uint8_t *consts, int entry, cost_t *cost) {
+  static avr_t m;
+  uint32_t x, seed = 12345;
+  uint64_t total = 0;
+
+  avr_init(&m, 1200000);
+  memcpy(m.flash, code, words * sizeof(uint16_t));
+  cost->words = entry;
+  cost->minc  = 1 << 30;
+  cost->maxc  = 0;
+  for(x = 0; x < 65536; x++) {
+    uint16_t result, want = k->spec(x);
+    int      cyc = 0, i;
+
+    // Random scratch registers and status register
+    for(i = 0; i < 32; i++) {
+      seed = seed * 1103515245 + 12345;
+      m.data[i] = seed >> 16;
+    }
+    seed = seed * 1103515245 + 12345;
+    m.data[AVR_SREG] = (seed >> 16) & 0x7F;
+    m.data[1] = 0;
+    for(i = 0; consts && i < 8 && consts[i]; i += 2) m.data[consts[i]] = consts[i + 1];
+    m.data[in[0]] = x & 0xFF;
+    if(in[1]) m.data[in[1]] = x >> 8;
+    m.data[AVR_SPL] = AVR_RAMEND;
+    m.pc    = 0;
+    m.fault = 0;
+
+    // Run until the end of the kernel code
+    while(m.pc != entry && !m.fault && cyc < 10000) cyc += avr_step(&m);
+    if(m.fault || m.pc != entry) return -1;
+    result = m.data[out[0]] | (k->outbytes == 2 ? m.data[out[1]] << 8 : 0);
+    if(k->outbytes == 1) want &= 0xFF;
+    if(result != want) return -1;
+    if(cyc < cost->minc) cost->minc = cyc;
+    if(cyc > cost->maxc) cost->maxc = cyc;
+    total += cyc;
+  }
+  cost->avgc = (double)total / 65536;
+  return 0;
+}
+
+// Verify the reference code of the shipped firmware
+static int verify_ref(const kernel_t *k, cost_t *cost) {
+  uint16_t code[256];
+  int      n = k->nref, lib;
+
+  memcpy(code, k->ref, n * sizeof(uint16_t));
+  if(k->spec != spec_damping) return verify(k, code, n, k->refin, k->refout, k->refconst, n, cost);
+
+  // Velocity damping: append "rjmp end" and libgcc, patch the calls
+  lib = n + 1;
+  code[n] = 0xC000 | ((sizeof(libgcc) / 2) & 0x0FFF);
+  memcpy(code + lib, libgcc, sizeof(libgcc));
+  code[2] = 0xD000 | ((lib + LIB_MULHI3    - 3) & 0x0FFF);
+  code[5] = 0xD000 | ((lib + LIB_DIVMODHI4 - 6) & 0x0FFF);
+  if(verify(k, code, lib + sizeof(libgcc) / 2, k->refin, k->refout, NULL, lib + sizeof(libgcc) / 2, cost))
+    return -1;
+  cost->words = n;
+  return 0;
+}
+
+// ===================================================================================
+// Search
+// ===================================================================================
+
+static insn_t    alpha[MAXALPHA];
+static int       nalpha;
+static node_t   *nodes;
+static int32_t  *hashtab;
+static int       nnodes, maxnodes, levelnodes[MAXLEN + 1], levelmax;
+static uint16_t  testin[NTEST];
+static uint8_t   testtmp[NTEST], testsreg[NTEST];
+
+// Add instruction to alphabet
+static void addinsn(uint8_t cond, uint8_t creg, uint8_t cbit, uint8_t op, uint8_t d, uint8_t r) {
+  insn_t in = {cond, creg, cbit, op, d, r};
+  if(nalpha < MAXALPHA) alpha[nalpha++] = in;
+}
+
+// Build alphabet for kernel
+static void build_alphabet(const kernel_t *k) {
+  int op, d, r, i, c, b;
+  nalpha = 0;
+  for(c = C_NONE; c <= C_SBRS; c++) {
+    for(b = 0; b < ((c >= C_SBRC) ? NREG * 2 : 1); b++) {
+      uint8_t creg = b / 2, cbit = (b & 1) ? 7 : 0;
+      for(op = 0; op < OP_COUNT; op++) {
+        // Conditional instructions: moves, loads and simple arithmetic only
+        if(c != C_NONE && !(op == OP_MOV || op == OP_LDI || op == OP_EOR || op == OP_SUBI ||
+                            op == OP_INC || op == OP_DEC || op == OP_COM || op == OP_NEG ||
+                            op == OP_ORI || op == OP_ANDI)) continue;
+        for(d = 0; d < NREG; d++) {
+          if(op >= OP_LDI) {
+            for(i = 0; i < k->nconsts; i++) addinsn(c, creg, cbit, op, d, k->consts[i]);
+          } else if(op >= OP_COM) {
+            addinsn(c, creg, cbit, op, d, 0);
+          } else {
+            for(r = 0; r <= R_ZERO; r++) {
+              if(r == d && (op == OP_MOV || op == OP_CP || op == OP_CPC)) continue;
+              if(r == R_ZERO && (op == OP_AND || op == OP_MOV)) continue;
+              addinsn(c, creg, cbit, op, d, r);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// Distance of a state to the kernel output (bits wrong), 0 = solved on all tests
+static int distance(const kernel_t *k, const mstate_t *st) {
+  int t, dist = 0;
+  for(t = 0; t < NTEST; t++) {
+    uint16_t want = k->spec(testin[t]);
+    dist += __builtin_popcount((st[t].reg[R_LO] ^ want) & 0xFF);
+    if(k->outbytes == 2) dist += __builtin_popcount(st[t].reg[R_HI] ^ (want >> 8));
+  }
+  return dist;
+}
+
+// Hash of node states
+static uint32_t hashstate(const mstate_t *st) {
+  const uint8_t *p = (const uint8_t *)st;
+  uint64_t h = 1469598103934665603ULL;
+  size_t   i;
+  for(i = 0; i < sizeof(mstate_t) * NTEST; i++) h = (h ^ p[i]) * 1099511628211ULL;
+  return (uint32_t)(h >> 20) & ((1 << HASHBITS) - 1);
+}
+
+// Insert node if its states are new, returns node index or -1
+static int insert(const node_t *n) {
+  uint32_t h = hashstate(n->st);
+  while(hashtab[h] >= 0) {
+    if(!memcmp(nodes[hashtab[h]].st, n->st, sizeof(n->st))) return -1;
+    h = (h + 1) & ((1 << HASHBITS) - 1);
+  }
+  if(nnodes >= maxnodes || levelnodes[n->len] >= levelmax) return -1;
+  levelnodes[n->len]++;
+  nodes[nnodes] = *n;
+  hashtab[h] = nnodes;
+  return nnodes++;
+}
+
+// Reconstruct instruction sequence of node followed by alphabet entry a
+static int sequence(int idx, int a, insn_t *seq) {
+  insn_t tmp[MAXLEN];
+  int    n = 0, i;
+  tmp[n++] = alpha[a];
+  for(; idx > 0; idx = nodes[idx].parent) tmp[n++] = alpha[nodes[idx].insn];
+  for(i = 0; i < n; i++) seq[i] = tmp[n - 1 - i];
+  return n;
+}
+
+// Compare node indices by score for the beam
+static int cmpscore(const void *a, const void *b) {
+  return nodes[*(const int32_t *)a].score - nodes[*(const int32_t *)b].score;
+}
+
+// Search kernel, returns 0 if a sequence was found
+static int search(const kernel_t *k, int maxlen, int beam, int all) {
+  static insn_t best[MAXLEN], seq[MAXLEN];
+  static const uint8_t regs[2] = {24, 25};
+  uint16_t code[2 * MAXLEN];
+  cost_t   ref, cost, bestcost = {0, 0, 0, 0};
+  int      len, bestn = 0, found = 0, tries = 0, exhaustive = 1, i, t;
+  int32_t *level = malloc(sizeof(int32_t) * maxnodes);
+  uint32_t seed = 1;
+  node_t   root;
+
+  build_alphabet(k);
+  printf("Kernel %s: %s\n", k->name, k->desc);
+  printf("  alphabet %d instructions, %d test inputs\n", nalpha, NTEST);
+  if(verify_ref(k, &ref)) {
+    printf("  reference code does not match the specification!\n\n");
+    free(level);
+    return -1;
+  }
+
+  // Test inputs: boundary values and random values, random scratch register and flags
+  for(t = 0; t < NTEST; t++) {
+    static const uint16_t edge[] = {0x0000, 0x0001, 0xFFFF, 0x8000, 0x7FFF, 0xFF9C, 0x0064, 0xFF9B, 0x0065};
+    seed = seed * 1103515245 + 12345;
+    testin[t]   = (t < 9) ? edge[t] : (seed >> 8) & 0xFFFF;
+    seed = seed * 1103515245 + 12345;
+    testtmp[t]  = seed >> 16;
+    seed = seed * 1103515245 + 12345;
+    testsreg[t] = (seed >> 16) & 0x1F;
+  }
+
+  // Root node
+  memset(hashtab, 0xFF, sizeof(int32_t) << HASHBITS);
+  memset(&root, 0, sizeof(root));
+  for(t = 0; t < NTEST; t++) {
+    root.st[t].reg[R_LO]  = testin[t] & 0xFF;
+    root.st[t].reg[R_HI]  = testin[t] >> 8;
+    root.st[t].reg[R_TMP] = testtmp[t];
+    root.st[t].sreg       = testsreg[t];
+  }
+  root.parent = -1;
+  nnodes   = 0;
+  levelmax = maxnodes / maxlen;
+  memset(levelnodes, 0, sizeof(levelnodes));
+  insert(&root);
+
+  // Breadth first by length in words, stop when no shorter sequence can follow
+  for(len = 0; len < maxlen && !(found && bestcost.words <= len); len++) {
+    int nlevel = 0, idx, a, n;
+
+    for(idx = 0; idx < nnodes; idx++) if(nodes[idx].len == len) level[nlevel++] = idx;
+    if(nlevel > beam) {
+      qsort(level, nlevel, sizeof(int32_t), cmpscore);
+      exhaustive = 0;
+    }
+    printf("  length %d: %d states%s\n", len, nlevel, nlevel > beam ? " (beam)" : "");
+
+    for(n = 0; n < nlevel && n < beam; n++) {
+      idx = level[n];
+      for(a = 0; a < nalpha; a++) {
+        node_t nd;
+        int    d;
+        if(len + insnlen(&alpha[a]) > maxlen) continue;
+        if(found && len + insnlen(&alpha[a]) > bestcost.words) continue;
+        memcpy(nd.st, nodes[idx].st, sizeof(nd.st));
+        for(t = 0; t < NTEST; t++) exec(&alpha[a], &nd.st[t]);
+        d = distance(k, nd.st);
+        if(d) {
+          if(len + insnlen(&alpha[a]) == maxlen) continue;
+          nd.parent = idx;
+          nd.insn   = a;
+          nd.len    = len + insnlen(&alpha[a]);
+          nd.score  = d > 255 ? 255 : d;
+          if(insert(&nd) < 0 && levelnodes[nd.len] >= levelmax) exhaustive = 0;
+          continue;
+        }
+
+        // Candidate passes the tests: verify exhaustively on the simulator
+        if(tries++ >= MAXTRIES) continue;
+        {
+          int nseq = sequence(idx, a, seq), words = 0, j;
+          for(j = 0; j < nseq; j++) words += encode(&seq[j], code + words);
+          if(verify(k, code, words, regs, regs, NULL, words, &cost)) continue;
+          if(all) {
+            printf("  verified: %d words, %d-%d cycles\n", cost.words, cost.minc, cost.maxc);
+            for(j = 0; j < nseq; j++) print_insn(stdout, &seq[j], 0);
+          }
+          if(!found || cost.words < bestcost.words ||
+             (cost.words == bestcost.words && cost.maxc < bestcost.maxc)) {
+            memcpy(best, seq, sizeof(seq));
+            bestn    = nseq;
+            bestcost = cost;
+          }
+          found = 1;
+        }
+      }
+    }
+  }
+  free(level);
+
+  // Report
+  printf("  avr-gcc:  %2d words, %3d-%-3d cycles (avg %.1f)\n", ref.words, ref.minc, ref.maxc, ref.avgc);
+  if(!found) {
+    printf("  superopt: no equivalent sequence up to %d words%s\n\n", maxlen,
+           exhaustive ? "" : " (search not exhaustive)");
+    return -1;
+  }
+  printf("  superopt: %2d words, %3d-%-3d cycles (avg %.1f)%s\n", bestcost.words, bestcost.minc,
+         bestcost.maxc, bestcost.avgc, exhaustive ? ", optimal" : "");
+  printf("  saving:   %d bytes flash, %.1f cycles per call\n\n",
+         2 * (ref.words - bestcost.words), ref.avgc - bestcost.avgc);
+
+  // Inline assembly replacement, x is the kernel value, tmp an 8-bit scratch variable
+  {
+    int usetmp = 0, imm = 0;
+    for(i = 0; i < bestn; i++) {
+      if(best[i].d == R_TMP || (best[i].op < OP_COM && best[i].r == R_TMP) ||
+         (best[i].cond >= C_SBRC && best[i].creg == R_TMP)) usetmp = 1;
+      if(best[i].d == R_TMP && best[i].op >= OP_LDI) imm = 1;
+    }
+    printf("  // %s\n  asm (\n", k->desc);
+    for(i = 0; i < bestn; i++) print_insn(stdout, &best[i], 1);
+    if(usetmp) printf("    : \"+r\" (x), \"=&%c\" (tmp)\n  );\n\n", imm ? 'd' : 'r');
+    else       printf("    : \"+r\" (x)\n  );\n\n");
+  }
+  return 0;
+}
+
+// Print usage
+static void usage(void) {
+  fprintf(stderr,
+    "Usage: superopt [options] [kernel...]\n"
+    "  -l N       maximum sequence length in words (default 6)\n"
+    "  -b N       maximum number of states per length (beam width, default 20000)\n"
+    "  -a         print all verified sequences of the shortest length\n"
+    "  kernels: lfsr, clamp, output, damping (default all)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int    maxlen = 6, beam = 20000, all = 0, opt, i;
+  size_t k;
+
+  while((opt = getopt(argc, argv, "l:b:ah")) != -1) {
+    switch(opt) {
+      case 'l': maxlen = atoi(optarg); break;
+      case 'b': beam   = atoi(optarg); break;
+      case 'a': all    = 1; break;
+      default:  usage();
+    }
+  }
+  if(maxlen < 1 || maxlen > MAXLEN || beam < 1) usage();
+
+  // Memory for nodes and hash table
+  maxnodes = (1 << HASHBITS) / 2;
+  nodes    = malloc(sizeof(node_t) * maxnodes);
+  hashtab  = malloc(sizeof(int32_t) << HASHBITS);
+  if(!nodes || !hashtab) {
+    fprintf(stderr, "Error: out of memory\n");
+    return 1;
+  }
+
+  for(k = 0; k < NKERNELS; k++) {
+    int selected = (optind == argc);
+    for(i = optind; i < argc; i++) if(!strcmp(argv[i], kernels[k].name)) selected = 1;
+    if(selected) search(&kernels[k], maxlen, beam, all);
+  }
+  free(nodes);
+  free(hashtab);
+  return 0;
+}
@@ -0,0 +1,376 @@
+// ===================================================================================
+// Project:   TinyCandle - Firmware Simulator
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Runs the TinyCandle firmware hex file on the ATtiny13A simulator. Button presses
+// can be scheduled to exercise the power-down and wake-up path. Optionally a Value
+// Change Dump of the pins PB0-PB4, OCR0A, OCR0B, TCNT0, the sleep state and the
+// interrupt flags is streamed to disk for inspection with GTKWave. The OCR0A/OCR0B
+// values of every frame can be recorded as trace file for traceq. The supply current is
+// estimated with the power model of the board from the simulated sleep states, the
+// levels of the LED and MOSFET pins and the PWM edges. Cycles spent in the delay loops
+// (_delay_loop_1/2: dec or sbiw followed by brne back to it) are counted separately,
+// so the busy cycles per frame are the cost of updateCandle() and the main loop.
+// The peak of the busy cycles between two delays is the worst main loop iteration
+// (with several flames the heaviest sub-frame).
+//
+// Usage:
+// ------
+// tinysim [options] firmware.hex
+//   -f HZ        clock frequency in Hz (default 1200000)
+//   -t MS        simulated time in milliseconds (default 10000)
+//   -p MS[:LEN]  press button at MS for LEN milliseconds (default 200), repeatable
+//   -o FILE      write Value Change Dump to FILE
+//   -d N         VCD decimation: sample signals every N clock cycles (default 1)
+//   -r FILE      record OCR0A/OCR0B of every frame to trace FILE
+//   -b REV       board revision of the power model (default datasheet values)
+//   -B FILE      file of the board revisions (default boards.txt)
+//   -P FILE      write execution profile (count and cycles per address) for asmdiff
+//   -q           print only stack, cycles per frame, fps, current, busy cycles, mWh/h,
+//                peak busy cycles between two delays
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "avrsim.h"
+#include "power.h"
+#include "trace.h"
+#include "vcd.h"
+
+// Default settings
+#define DEFAULTFREQ   1200000
+#define DEFAULTTIME   10000
+#define DEFAULTPRESS  200
+#define MAXPRESS      64
+#define BUTTON        2           // button on PB2
+#define LEDA          0           // LED 1/2 on PB0
+#define LEDB          1           // LED 3/4 on PB1
+#define MOSFET        4           // MOSFET on PB4
+
+// Button press schedule in clock cycles
+typedef struct {
+  uint64_t start;
+  uint64_t end;
+} press_t;
+
+// VCD tracing context
+typedef struct {
+  vcd_t    vcd;
+  uint32_t decim;
+  uint32_t count;
+  int      pin[5];
+  int      ocra, ocrb, tcnt, sleep, isr, flagi;
+  int      tov0, ocf0a, ocf0b, pcif, intf0;
+} trace_t;
+
+// Supply current meter: cycles in every state
+typedef struct {
+  uint64_t awake, idle, pwrdown;  // cycles of the sleep states
+  uint64_t delay;                 // awake cycles in delay loops
+  uint64_t tick, peak;            // busy cycles since the last delay loop and their maximum
+  uint64_t ticks;                 // delay loops (main loop iterations, sub-frames)
+  uint64_t gate;                  // cycles with MOSFET on
+  uint64_t led[2];                // cycles with LEDs on
+  uint64_t edges;                 // rising edges of the LED pins
+  uint64_t frames;                // OCR0B writes
+  uint8_t  pins;                  // LED pin levels at last step
+} meter_t;
+
+// Execution profile: executions and cycles per instruction address, interrupt dispatch
+// and wake-up halt in a bucket of their own
+typedef struct {
+  uint64_t count[AVR_FLASHWORDS];
+  uint64_t cycles[AVR_FLASHWORDS];
+  uint64_t dcount, dcycles;
+} profile_t;
+
+// Convert clock cycles to nanoseconds without overflow
+static uint64_t cycles2ns(uint64_t cycles, uint32_t freq) {
+  return (cycles / freq) * 1000000000ULL + (cycles % freq) * 1000000000ULL / freq;
+}
+
+// Sample signals, called for every clock cycle
+static void trace_hook(avr_t *m, void *ctx) {
+  trace_t *t = (trace_t *)ctx;
+  int      i;
+  if(++t->count < t->decim) return;
+  t->count = 0;
+  vcd_time(&t->vcd, cycles2ns(m->cycles, m->freq));
+  for(i = 0; i < 5; i++) vcd_set(&t->vcd, t->pin[i], (m->pins >> i) & 1);
+  vcd_set(&t->vcd, t->ocra,  m->data[AVR_OCR0A]);
+  vcd_set(&t->vcd, t->ocrb,  m->data[AVR_OCR0B]);
+  vcd_set(&t->vcd, t->tcnt,  m->data[AVR_TCNT0]);
+  vcd_set(&t->vcd, t->sleep, m->sleep);
+  vcd_set(&t->vcd, t->isr,   m->isr != 0);
+  vcd_set(&t->vcd, t->flagi, (m->data[AVR_SREG]  >> AVR_SREG_I) & 1);
+  vcd_set(&t->vcd, t->tov0,  (m->data[AVR_TIFR0] >> AVR_TOV0)   & 1);
+  vcd_set(&t->vcd, t->ocf0a, (m->data[AVR_TIFR0] >> AVR_OCF0A)  & 1);
+  vcd_set(&t->vcd, t->ocf0b, (m->data[AVR_TIFR0] >> AVR_OCF0B)  & 1);
+  vcd_set(&t->vcd, t->pcif,  (m->data[AVR_GIFR]  >> AVR_PCIF)   & 1);
+  vcd_set(&t->vcd, t->intf0, (m->data[AVR_GIFR]  >> AVR_INTF0)  & 1);
+}
+
+// Frame end: the firmware writes OCR0B (after OCR0A in updateCandle)
+typedef struct {
+  meter_t        *meter;
+  trace_writer_t *record;         // NULL if not recording
+} frame_t;
+
+static void frame_hook(avr_t *m, uint16_t addr, uint8_t value, uint8_t write, void *ctx) {
+  frame_t *f = (frame_t *)ctx;
+  if(!write || addr != AVR_OCR0B) return;
+  f->meter->frames++;
+  if(f->record) trace_frame(f->record, m->data[AVR_OCR0A], value);
+}
+
+// Instruction at pc is part of a delay loop "1: dec/sbiw; brne 1b"
+static int delay_loop(const avr_t *m, uint16_t pc) {
+  const uint16_t *f = m->flash;
+  #define LOOPHEAD(op)  (((op) & 0xFF00) == 0x9700 || ((op) & 0xFE0F) == 0x940A)
+  #define BRNEBACK      0xF7F1    // brne .-4
+  if(pc + 1 < AVR_FLASHWORDS && LOOPHEAD(f[pc]) && f[pc + 1] == BRNEBACK) return 1;
+  return pc > 0 && pc < AVR_FLASHWORDS && f[pc] == BRNEBACK && LOOPHEAD(f[pc - 1]);
+}
+
+// Account cycles of one step to the states of the MCU and the pins
+static void meter_step(meter_t *e, const avr_t *m, int cycles) {
+  uint8_t out = m->data[AVR_DDRB] & m->pins;
+  uint8_t on  = (out >> MOSFET) & 1;
+  uint8_t leds = out & ((1 << LEDA) | (1 << LEDB));
+  if(m->sleep == AVR_AWAKE) e->awake += cycles;
+  else if(m->sleep == AVR_IDLE) e->idle += cycles;
+  else e->pwrdown += cycles;
+  if(on) {
+    e->gate += cycles;
+    if(leds & (1 << LEDA)) e->led[0] += cycles;
+    if(leds & (1 << LEDB)) e->led[1] += cycles;
+  }
+  e->edges += __builtin_popcount(leds & ~e->pins);
+  e->pins   = leds;
+}
+
+// Mean supply current in mA
+static double meter_current(const meter_t *e, const power_t *p, uint64_t cycles, uint32_t freq) {
+  double t = (double)cycles / freq;
+  if(!cycles) return 0;
+  return (power_mcu(p, freq) * e->awake + power_idle(p, freq) * e->idle + p->ipd * e->pwrdown
+        + power_gate(p) * e->gate + power_led(p) * (e->led[0] + e->led[1])) / cycles
+        + p->ipwm * e->edges / t / 1000;
+}
+
+// Define VCD signals
+static int trace_open(trace_t *t, const char *filename, uint32_t decim) {
+  char name[8];
+  int  i;
+  memset(t, 0, sizeof(*t));
+  if(vcd_open(&t->vcd, filename)) return -1;
+  t->decim = decim ? decim : 1;
+  for(i = 0; i < 5; i++) {
+    sprintf(name, "PB%d", i);
+    t->pin[i] = vcd_add(&t->vcd, name, 1);
+  }
+  t->ocra  = vcd_add(&t->vcd, "OCR0A", 8);
+  t->ocrb  = vcd_add(&t->vcd, "OCR0B", 8);
+  t->tcnt  = vcd_add(&t->vcd, "TCNT0", 8);
+  t->sleep = vcd_add(&t->vcd, "sleep", 2);
+  t->isr   = vcd_add(&t->vcd, "isr",   1);
+  t->flagi = vcd_add(&t->vcd, "SREG_I", 1);
+  t->tov0  = vcd_add(&t->vcd, "TOV0",  1);
+  t->ocf0a = vcd_add(&t->vcd, "OCF0A", 1);
+  t->ocf0b = vcd_add(&t->vcd, "OCF0B", 1);
+  t->pcif  = vcd_add(&t->vcd, "PCIF",  1);
+  t->intf0 = vcd_add(&t->vcd, "INTF0", 1);
+  vcd_begin(&t->vcd, "tinycandle", "1ns");
+  return 0;
+}
+
+// Print usage
+static void usage(void) {
+  fprintf(stderr,
+    "Usage: tinysim [options] firmware.hex\n"
+    "  -f HZ        clock frequency in Hz (default %d)\n"
+    "  -t MS        simulated time in milliseconds (default %d)\n"
+    "  -p MS[:LEN]  press button at MS for LEN milliseconds (default %d), repeatable\n"
+    "  -o FILE      write Value Change Dump to FILE\n"
+    "  -d N         VCD decimation: sample signals every N clock cycles (default 1)\n"
+    "  -r FILE      record OCR0A/OCR0B of every frame to trace FILE\n"
+    "  -b REV       board revision of the power model (default datasheet values)\n"
+    "  -B FILE      file of the board revisions (default " POWER_FILE ")\n"
+    "  -P FILE      write execution profile (count and cycles per address) for asmdiff\n"
+    "  -q           print only stack, cycles per frame, fps, current, busy cycles, mWh/h,\n"
+    "               peak busy cycles between two delays\n",
+    DEFAULTFREQ, DEFAULTTIME, DEFAULTPRESS);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  static avr_t m;
+  static profile_t prof;
+  trace_t   trace;
+  trace_writer_t record;
+  meter_t   meter;
+  frame_t   frame = {&meter, NULL};
+  power_t   power = power_default;
+  press_t   press[MAXPRESS];
+  int       npress = 0, pressed = 0, quiet = 0, i, opt;
+  uint32_t  freq = DEFAULTFREQ, decim = 1;
+  double    simtime = DEFAULTTIME, current, framecycles, busycycles;
+  char     *vcdfile = NULL, *recfile = NULL, *rev = NULL, *powerfile = POWER_FILE,
+           *proffile = NULL;
+  uint64_t  end, sleepcycles = 0;
+
+  // Parse command line
+  while((opt = getopt(argc, argv, "f:t:p:o:d:r:b:B:P:qh")) != -1) {
+    switch(opt) {
+      case 'f': freq    = strtoul(optarg, NULL, 0); break;
+      case 't': simtime = atof(optarg); break;
+      case 'o': vcdfile = optarg; break;
+      case 'd': decim   = strtoul(optarg, NULL, 0); break;
+      case 'r': recfile = optarg; break;
+      case 'b': rev     = optarg; break;
+      case 'B': powerfile = optarg; break;
+      case 'P': proffile = optarg; break;
+      case 'q': quiet   = 1; break;
+      case 'p': {
+        double at, len = DEFAULTPRESS;
+        if(npress >= MAXPRESS || sscanf(optarg, "%lf:%lf", &at, &len) < 1) usage();
+        press[npress].start = (uint64_t)(at * freq / 1000);
+        press[npress].end   = (uint64_t)((at + len) * freq / 1000);
+        npress++;
+        break;
+      }
+      default:  usage();
+    }
+  }
+  if(optind != argc - 1 || !freq) usage();
+  if(rev && power_load(&power, powerfile, rev)) {
+    fprintf(stderr, "Error: board %s not found in %s\n", rev, powerfile);
+    return 1;
+  }
+
+  // Load firmware
+  avr_init(&m, freq);
+  if(avr_loadhex(&m, argv[optind]) <= 0) {
+    fprintf(stderr, "Error: cannot load %s\n", argv[optind]);
+    return 1;
+  }
+
+  // Open VCD trace
+  if(vcdfile) {
+    if(trace_open(&trace, vcdfile, decim)) {
+      fprintf(stderr, "Error: cannot open %s\n", vcdfile);
+      return 1;
+    }
+    m.cyclehook = trace_hook;
+    m.hookctx   = &trace;
+  }
+
+  // Count frames and open frame trace
+  memset(&meter, 0, sizeof(meter));
+  if(recfile) {
+    if(trace_create(&record, recfile, 0)) {
+      fprintf(stderr, "Error: cannot open %s\n", recfile);
+      return 1;
+    }
+    frame.record = &record;
+  }
+  m.memhook = frame_hook;
+  m.memctx  = &frame;
+
+  // Run simulation
+  end = (uint64_t)(simtime * freq / 1000);
+  while(m.cycles < end && !m.fault) {
+    int now = 0;
+    for(i = 0; i < npress; i++)
+      if(m.cycles >= press[i].start && m.cycles < press[i].end) now = 1;
+    if(now != pressed) {
+      avr_setpin(&m, BUTTON, now, 0);
+      pressed = now;
+    }
+    if(m.sleep) {
+      meter_step(&meter, &m, 1);
+      sleepcycles += avr_step(&m);
+    } else {
+      uint16_t pc   = m.pc;
+      uint8_t  isr  = m.isr, halt = m.halt;
+      int      n    = avr_step(&m);
+      if(!m.isr && delay_loop(&m, pc)) {
+        meter.delay += n;
+        // Busy cycles between two delays, without the start-up before the first
+        if(meter.tick && meter.ticks++ && meter.tick > meter.peak) meter.peak = meter.tick;
+        meter.tick = 0;
+      } else meter.tick += n;
+      meter_step(&meter, &m, n);
+      // The pc of a faulting jump or return may be outside the flash
+      if(halt || m.isr > isr) {
+        prof.dcount++;
+        prof.dcycles += n;
+      } else if(pc < AVR_FLASHWORDS) {
+        prof.count[pc]++;
+        prof.cycles[pc] += n;
+      }
+    }
+  }
+
+  if(vcdfile) vcd_close(&trace.vcd);
+  if(recfile) {
+    // Frame rate while awake
+    double awake = (double)(m.cycles - sleepcycles) / freq;
+    record.hdr.fps = awake > 0 ? record.hdr.frames / awake : 0;
+    trace_close(&record);
+  }
+
+  // Write profile
+  if(proffile) {
+    FILE *f = fopen(proffile, "w");
+    if(!f) {
+      fprintf(stderr, "Error: cannot write %s\n", proffile);
+      return 1;
+    }
+    fprintf(f, "# tinysim profile of %s: address count cycles\n", argv[optind]);
+    fprintf(f, "frames %llu\n", (unsigned long long)meter.frames);
+    fprintf(f, "dispatch %llu %llu\n", (unsigned long long)prof.dcount, (unsigned long long)prof.dcycles);
+    for(i = 0; i < AVR_FLASHWORDS; i++)
+      if(prof.count[i]) fprintf(f, "0x%04x %llu %llu\n", i * 2,
+                                (unsigned long long)prof.count[i], (unsigned long long)prof.cycles[i]);
+    fclose(f);
+  }
+
+  // Print summary
+  current     = meter_current(&meter, &power, m.cycles, freq);
+  framecycles = meter.frames ? (double)(m.cycles - sleepcycles) / meter.frames : 0;
+  busycycles  = meter.frames ? (double)(m.cycles - sleepcycles - meter.delay) / meter.frames : 0;
+  if(quiet) {
+    printf("%d %.1f %.2f %.3f %.1f %.2f %llu\n", AVR_RAMEND - m.spmin, framecycles,
+           framecycles > 0 ? freq / framecycles : 0, current, busycycles, power.vcc * current,
+           (unsigned long long)meter.peak);
+    return m.fault ? 2 : 0;
+  }
+  printf("Simulated:   %.3f ms (%llu cycles @ %u Hz)\n", (double)m.cycles * 1000 / freq,
+         (unsigned long long)m.cycles, freq);
+  printf("Sleeping:    %.3f ms\n", (double)sleepcycles * 1000 / freq);
+  printf("Stack:       %d bytes high-water mark\n", AVR_RAMEND - m.spmin);
+  printf("Frames:      %llu, %.1f cycles per frame (%.2f fps)\n",
+         (unsigned long long)meter.frames, framecycles, framecycles > 0 ? freq / framecycles : 0);
+  printf("Busy:        %.1f cycles per frame outside delay loops\n", busycycles);
+  printf("Peak:        %llu busy cycles between two delays (%llu delays)\n",
+         (unsigned long long)meter.peak, (unsigned long long)meter.ticks);
+  printf("Current:     %.3f mA, %.2f mWh per hour (board %s)\n", current, power.vcc * current, power.board);
+  if(vcdfile) printf("VCD changes: %llu written to %s\n",
+                     (unsigned long long)trace.vcd.changes, vcdfile);
+  if(recfile) printf("Trace:       %llu frames recorded to %s\n",
+                     (unsigned long long)record.hdr.frames, recfile);
+  if(m.fault) {
+    fprintf(stderr, "Fault: %s at 0x%04x\n", avr_strfault(m.fault), m.faultpc * 2);
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,89 @@
+// ===================================================================================
+// Project:   TinyCandle - PWM Trace Files
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "trace.h"
+
+// Create trace file with preliminary header
+int trace_create(trace_writer_t *w, const char *filename, double fps) {
+  memset(w, 0, sizeof(*w));
+  w->f = fopen(filename, "wb");
+  if(!w->f) return -1;
+  setvbuf(w->f, NULL, _IOFBF, 1 << 20);
+  w->hdr.magic    = TRACE_MAGIC;
+  w->hdr.version  = TRACE_VERSION;
+  w->hdr.channels = 2;
+  w->hdr.fps      = fps;
+  return fwrite(&w->hdr, sizeof(w->hdr), 1, w->f) == 1 ? 0 : -1;
+}
+
+// Check header and cut the file after the frames
+int trace_resume(trace_writer_t *w, const char *filename, uint64_t frames) {
+  memset(w, 0, sizeof(*w));
+  w->f = fopen(filename, "r+b");
+  if(!w->f) return -1;
+  if(fread(&w->hdr, sizeof(w->hdr), 1, w->f) != 1 || w->hdr.magic != TRACE_MAGIC ||
+     w->hdr.channels != 2 || fseek(w->f, 0, SEEK_END) ||
+     ftell(w->f) < (long)(sizeof(w->hdr) + 2 * frames) ||
+     ftruncate(fileno(w->f), sizeof(w->hdr) + 2 * frames) ||
+     fseek(w->f, 0, SEEK_END) || ftell(w->f) != (long)(sizeof(w->hdr) + 2 * frames)) {
+    fclose(w->f);
+    return -1;
+  }
+  setvbuf(w->f, NULL, _IOFBF, 1 << 20);
+  w->hdr.frames = frames;
+  return 0;
+}
+
+int trace_flush(trace_writer_t *w) {
+  return (fflush(w->f) || fdatasync(fileno(w->f))) ? -1 : 0;
+}
+
+// Rewrite header with the frame count
+int trace_close(trace_writer_t *w) {
+  int err = fseek(w->f, 0, SEEK_SET) || fwrite(&w->hdr, sizeof(w->hdr), 1, w->f) != 1;
+  return (fclose(w->f) || err) ? -1 : 0;
+}
+
+// Map file and check header
+int trace_map(trace_map_t *t, const char *filename) {
+  struct stat st;
+  void       *p;
+  int         fd = open(filename, O_RDONLY);
+
+  memset(t, 0, sizeof(*t));
+  if(fd < 0) return -1;
+  if(fstat(fd, &st) || st.st_size < (off_t)sizeof(trace_header_t)) {
+    close(fd);
+    return -1;
+  }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED) return -1;
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+  t->hdr    = (const trace_header_t *)p;
+  t->frames = (const uint8_t *)p + sizeof(trace_header_t);
+  t->size   = st.st_size;
+  t->count  = (st.st_size - sizeof(trace_header_t)) / 2;
+  if(t->hdr->magic != TRACE_MAGIC || t->hdr->channels != 2) {
+    trace_unmap(t);
+    return -1;
+  }
+  if(t->hdr->frames && t->hdr->frames < t->count) t->count = t->hdr->frames;
+  return 0;
+}
+
+void trace_unmap(trace_map_t *t) {
+  if(t->hdr) munmap((void *)t->hdr, t->size);
+  memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,74 @@
+// ===================================================================================
+// Project:   TinyCandle - PWM Trace Files
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Binary trace of the OCR0A/OCR0B values of every frame, written by the simulator
+// (tinysim -r) or the host engine (traceq -g) and queried by traceq. The file is a
+// 32 byte header followed by two bytes (OCR0A, OCR0B) per frame, so it can be memory
+// mapped and processed in place.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_MAGIC   0x52544354  // "TCTR"
+#define TRACE_VERSION 1
+
+// File header (little endian)
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t channels;              // bytes per frame (OCR0A, OCR0B)
+  double   fps;                   // frame rate
+  uint64_t frames;                // number of frames
+  uint64_t reserved;
+} trace_header_t;
+
+// Trace writer
+typedef struct {
+  FILE          *f;
+  trace_header_t hdr;
+} trace_writer_t;
+
+// Create trace file, returns 0 on success
+int  trace_create(trace_writer_t *w, const char *filename, double fps);
+
+// Reopen trace file for appending after frame count frames (e.g. from a checkpoint),
+// later frames are discarded, returns 0 on success
+int  trace_resume(trace_writer_t *w, const char *filename, uint64_t frames);
+
+// Write buffered frames to disk, returns 0 on success
+int  trace_flush(trace_writer_t *w);
+
+// Append one frame
+static inline void trace_frame(trace_writer_t *w, uint8_t ocra, uint8_t ocrb) {
+  putc(ocra, w->f);
+  putc(ocrb, w->f);
+  w->hdr.frames++;
+}
+
+// Write frame count and close, returns 0 on success
+int  trace_close(trace_writer_t *w);
+
+// Memory-mapped trace
+typedef struct {
+  const trace_header_t *hdr;
+  const uint8_t        *frames;   // OCR0A, OCR0B of frame n at 2n, 2n + 1
+  uint64_t              count;
+  size_t                size;
+} trace_map_t;
+
+// Map trace file read-only, returns 0 on success
+int  trace_map(trace_map_t *t, const char *filename);
+void trace_unmap(trace_map_t *t);
+
+#endif
@@ -0,0 +1,414 @@
+// ===================================================================================
+// Project:   TinyCandle - Trace Query Tool
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Statistics of OCR0A/OCR0B trace files over any number of frames. The trace is
+// memory mapped and split into chunks of whole windows, which are processed by worker
+// threads. Windowed minimum, maximum and mean are SIMD reductions (SSE2 when
+// available), duty histograms and gusts are counted in the same pass over the data.
+// Percentiles and clip counts at +-MAXDEV are calculated from the histograms. A gust
+// is a burst of clipping after at least one second without clipping, which catches
+// the occasional "bonus wind" of the candle simulation.
+// Generating traces of days or weeks is a soak run of the engine. With a checkpoint
+// journal (-k) the engine state is saved every few seconds after the trace has been
+// flushed, and an interrupted run continues bit-exactly from the last checkpoint.
+// With several flames per MCU (FLAMES in config.h) the trace shows the first flame.
+//
+// Usage:
+// ------
+// traceq [options] trace
+//   -j N       number of threads (default number of CPUs)
+//   -w N       window length in frames (default one minute)
+//   -o FILE    write windowed statistics as CSV
+//   -H         print duty histograms
+//   -g N       generate trace of N frames with the host engine instead of querying
+//   -e E       engine of the generated trace (default 0)
+//   -s SEED    LFSR seed of the generated trace
+//   -k FILE    checkpoint journal to resume an interrupted generation
+//   -i SEC     seconds between checkpoints (default 5)
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "checkpoint.h"
+#include "engine.h"
+#include "trace.h"
+
+// Query settings
+#define MAXTHREADS    64
+#define CHUNKFRAMES   (1 << 20)   // minimum frames per work chunk
+#define CLIPLOW       (128 - MAXDEV)
+#define CLIPHIGH      (128 + MAXDEV)
+#define GENFPS        63.1        // frame rate of generated traces (firmware as shipped)
+#define GENCHECK      (1 << 16)   // frames between checkpoint tests
+
+// Statistics of a window
+typedef struct {
+  uint8_t  min[2];
+  uint8_t  max[2];
+  uint64_t sum[2];
+} window_t;
+
+// Results of a worker
+typedef struct {
+  uint64_t hist[2][256];
+  uint64_t gusts;
+} result_t;
+
+static trace_map_t trace;
+static window_t   *windows;
+static uint64_t    winlen, nwindows, chunkwins, nchunks, nextchunk;
+static uint64_t    quiet;         // frames without clipping before a gust
+
+// ===================================================================================
+// Reductions
+// ===================================================================================
+
+// Minimum, maximum and sum of both channels of frames [start, end)
+static void reduce(const uint8_t *p, uint64_t n, window_t *w) {
+  uint8_t  mina = 255, minb = 255, maxa = 0, maxb = 0;
+  uint64_t suma = 0, sumb = 0, i = 0;
+
+#ifdef __SSE2__
+  // 8 frames per vector: OCR0A in the low, OCR0B in the high byte of every word
+  __m128i vmin = _mm_set1_epi8(-1), vmax = _mm_setzero_si128();
+  __m128i mask = _mm_set1_epi16(0x00FF), sa = _mm_setzero_si128(), sb = _mm_setzero_si128();
+  uint8_t  tmp[16];
+  uint64_t lanes[2];
+  int      j;
+  for(; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + 2 * i));
+    vmin = _mm_min_epu8(vmin, v);
+    vmax = _mm_max_epu8(vmax, v);
+    sa   = _mm_add_epi64(sa, _mm_sad_epu8(_mm_and_si128(v, mask), _mm_setzero_si128()));
+    sb   = _mm_add_epi64(sb, _mm_sad_epu8(_mm_srli_epi16(v, 8), _mm_setzero_si128()));
+  }
+  _mm_storeu_si128((__m128i *)tmp, vmin);
+  for(j = 0; j < 16; j += 2) {
+    if(tmp[j]     < mina) mina = tmp[j];
+    if(tmp[j + 1] < minb) minb = tmp[j + 1];
+  }
+  _mm_storeu_si128((__m128i *)tmp, vmax);
+  for(j = 0; j < 16; j += 2) {
+    if(tmp[j]     > maxa) maxa = tmp[j];
+    if(tmp[j + 1] > maxb) maxb = tmp[j + 1];
+  }
+  _mm_storeu_si128((__m128i *)lanes, sa);
+  suma = lanes[0] + lanes[1];
+  _mm_storeu_si128((__m128i *)lanes, sb);
+  sumb = lanes[0] + lanes[1];
+#endif
+
+  for(; i < n; i++) {
+    uint8_t a = p[2 * i], b = p[2 * i + 1];
+    if(a < mina) mina = a;
+    if(a > maxa) maxa = a;
+    if(b < minb) minb = b;
+    if(b > maxb) maxb = b;
+    suma += a;
+    sumb += b;
+  }
+  w->min[0] = mina; w->max[0] = maxa; w->sum[0] = suma;
+  w->min[1] = minb; w->max[1] = maxb; w->sum[1] = sumb;
+}
+
+// Clipping in frame
+static inline int clipped(const uint8_t *p) {
+  return p[0] == CLIPLOW || p[0] == CLIPHIGH || p[1] == CLIPLOW || p[1] == CLIPHIGH;
+}
+
+// Histograms and gusts of frames [start, end), four partial histograms per channel
+// avoid stalls on repeated values
+static void count(uint64_t start, uint64_t end, result_t *r) {
+  static __thread uint32_t part[8][256];
+  const uint8_t *p = trace.frames;
+  uint64_t       i, last, flush = 0;
+  int            k, v;
+
+  // Last clipping before the chunk
+  for(last = start; last > 0 && start - last <= quiet && !clipped(p + 2 * (last - 1)); last--);
+  last = (last > 0 && start - last <= quiet) ? last - 1 : UINT64_MAX;
+
+  memset(part, 0, sizeof(part));
+  for(i = start; i < end; i++) {
+    const uint8_t *f = p + 2 * i;
+    part[(i & 3) * 2][f[0]]++;
+    part[(i & 3) * 2 + 1][f[1]]++;
+    if(clipped(f)) {
+      if(last == UINT64_MAX || i - last > quiet) r->gusts++;
+      last = i;
+    }
+    // Flush partial counters before they can overflow
+    if(++flush == 0x3FFFFFFF) {
+      for(k = 0; k < 8; k++) for(v = 0; v < 256; v++) r->hist[k & 1][v] += part[k][v];
+      memset(part, 0, sizeof(part));
+      flush = 0;
+    }
+  }
+  for(k = 0; k < 8; k++) for(v = 0; v < 256; v++) r->hist[k & 1][v] += part[k][v];
+}
+
+// Worker thread: chunks of whole windows
+static void *worker(void *arg) {
+  result_t *r = (result_t *)arg;
+  uint64_t  c, w;
+  while((c = __sync_fetch_and_add(&nextchunk, 1)) < nchunks) {
+    uint64_t first = c * chunkwins, last = first + chunkwins;
+    if(last > nwindows) last = nwindows;
+    for(w = first; w < last; w++) {
+      uint64_t start = w * winlen, end = start + winlen;
+      if(end > trace.count) end = trace.count;
+      reduce(trace.frames + 2 * start, end - start, &windows[w]);
+    }
+    count(first * winlen, (last * winlen < trace.count) ? last * winlen : trace.count, r);
+  }
+  return NULL;
+}
+
+// ===================================================================================
+// Output
+// ===================================================================================
+
+// Percentile from histogram
+static int percentile(const uint64_t *hist, uint64_t total, double p) {
+  uint64_t sum = 0, target = (uint64_t)(p / 100 * (total - 1));
+  int      v;
+  for(v = 0; v < 256; v++) {
+    sum += hist[v];
+    if(sum > target) return v;
+  }
+  return 255;
+}
+
+// Print statistics of one channel
+static void print_channel(const char *name, int ch, const uint64_t *hist, uint64_t total, int histo) {
+  static const double pct[] = {1, 5, 25, 50, 75, 95, 99};
+  double   mean = 0, wmin = 1e9, wmax = 0, range = 0;
+  uint64_t w;
+  int      v, min = -1, max = 0;
+  size_t   i;
+
+  for(v = 0; v < 256; v++) {
+    mean += (double)hist[v] * v;
+    if(hist[v]) {
+      if(min < 0) min = v;
+      max = v;
+    }
+  }
+  for(w = 0; w < nwindows; w++) {
+    uint64_t len = (w == nwindows - 1) ? trace.count - w * winlen : winlen;
+    double   m   = (double)windows[w].sum[ch] / len;
+    if(m < wmin) wmin = m;
+    if(m > wmax) wmax = m;
+    range += windows[w].max[ch] - windows[w].min[ch];
+  }
+  printf("%s:\n", name);
+  printf("  mean %.2f, min %d, max %d\n", mean / total, min, max);
+  printf("  percentiles:");
+  for(i = 0; i < sizeof(pct) / sizeof(pct[0]); i++) printf(" p%g=%d", pct[i], percentile(hist, total, pct[i]));
+  printf("\n  clipped: %llu low (%.3f%%), %llu high (%.3f%%)\n",
+         (unsigned long long)hist[CLIPLOW], 100.0 * hist[CLIPLOW] / total,
+         (unsigned long long)hist[CLIPHIGH], 100.0 * hist[CLIPHIGH] / total);
+  printf("  windows: mean %.2f - %.2f, average range %.1f\n", wmin, wmax, range / nwindows);
+  if(histo) {
+    printf("  histogram (value: frames):\n");
+    for(v = 0; v < 256; v++)
+      if(hist[v]) printf("    %3d: %llu\n", v, (unsigned long long)hist[v]);
+  }
+}
+
+// Write windowed statistics as CSV
+static int write_csv(const char *filename, double fps) {
+  FILE    *f = fopen(filename, "w");
+  uint64_t w;
+  if(!f) return -1;
+  fprintf(f, "window,start_s,min_a,max_a,mean_a,min_b,max_b,mean_b\n");
+  for(w = 0; w < nwindows; w++) {
+    uint64_t len = (w == nwindows - 1) ? trace.count - w * winlen : winlen;
+    fprintf(f, "%llu,%.3f,%d,%d,%.3f,%d,%d,%.3f\n", (unsigned long long)w, w * winlen / fps,
+            windows[w].min[0], windows[w].max[0], (double)windows[w].sum[0] / len,
+            windows[w].min[1], windows[w].max[1], (double)windows[w].sum[1] / len);
+  }
+  return fclose(f);
+}
+
+// ===================================================================================
+// Main
+// ===================================================================================
+
+// Soak run state
+typedef struct {
+  uint64_t frames;                // frames in the trace
+  candle_t candle[FLAMES];        // engine and LFSR state after them
+} soak_t;
+
+// Generate trace with the host engine, resume from checkpoint journal if given
+static int generate(const char *filename, uint64_t frames, int engine, uint16_t seed,
+                    const char *ckptfile, double interval) {
+  trace_writer_t w;
+  checkpoint_t   ckpt;
+  soak_t         s;
+  const soak_t  *last = NULL;
+  uint64_t       i;
+  int            sub;
+
+  flames_init(s.candle, FLAMES, engine, seed);
+  s.frames = 0;
+  if(ckptfile) {
+    uint32_t id = checkpoint_hash(0, &engine, sizeof(engine));
+    id = checkpoint_hash(id, &seed, sizeof(seed));
+    if(checkpoint_open(&ckpt, ckptfile, id, 1, sizeof(soak_t)) < 0) {
+      fprintf(stderr, "Error: cannot open checkpoint %s (journal of another run?)\n", ckptfile);
+      return -1;
+    }
+    ckpt.interval = interval;
+    last = checkpoint_get(&ckpt, 0);
+  }
+  if(last) {
+    const iir_t *iir = s.candle[0].iir;
+    s = *last;
+    for(sub = 0; sub < FLAMES; sub++) s.candle[sub].iir = iir;
+    if(trace_resume(&w, filename, s.frames)) return -1;
+    printf("Resuming at frame %llu\n", (unsigned long long)s.frames);
+  } else if(trace_create(&w, filename, GENFPS)) return -1;
+
+  for(i = s.frames; i < frames; i++) {
+    // The trace shows the first flame, which is updated in the first sub-frame
+    flames_update(s.candle, FLAMES, SUBFRAMES, 0);
+    trace_frame(&w, s.candle[0].ocra, s.candle[0].ocrb);
+    for(sub = 1; sub < SUBFRAMES; sub++) flames_update(s.candle, FLAMES, SUBFRAMES, sub);
+    // Checkpoint only frames which are on disk
+    if(ckptfile && !(i & (GENCHECK - 1)) && checkpoint_due(&ckpt)) {
+      s.frames = i + 1;
+      if(trace_flush(&w)) return -1;
+      checkpoint_put(&ckpt, 0, &s);
+      checkpoint_sync(&ckpt, 1);
+    }
+  }
+  if(trace_close(&w)) return -1;
+  if(ckptfile) {
+    s.frames = frames;
+    checkpoint_put(&ckpt, 0, &s);
+    if(checkpoint_close(&ckpt)) return -1;
+  }
+  return 0;
+}
+
+// Print usage
+static void usage(void) {
+  fprintf(stderr,
+    "Usage: traceq [options] trace\n"
+    "  -j N       number of threads (default number of CPUs)\n"
+    "  -w N       window length in frames (default one minute)\n"
+    "  -o FILE    write windowed statistics as CSV\n"
+    "  -H         print duty histograms\n"
+    "  -g N       generate trace of N frames with the host engine instead of querying\n"
+    "  -e E       engine of the generated trace (default 0)\n"
+    "  -s SEED    LFSR seed of the generated trace\n"
+    "  -k FILE    checkpoint journal to resume an interrupted generation\n"
+    "  -i SEC     seconds between checkpoints (default 5)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  pthread_t threads[MAXTHREADS];
+  result_t *results, total;
+  char     *csvfile = NULL, *ckptfile = NULL;
+  uint64_t  gen = 0;
+  double    fps, interval = CHECKPOINT_INTERVAL;
+  int       nthreads = sysconf(_SC_NPROCESSORS_ONLN), histo = 0, engine = 0, opt, i, v;
+  uint16_t  seed = 0;
+
+  while((opt = getopt(argc, argv, "j:w:o:Hg:e:s:k:i:h")) != -1) {
+    switch(opt) {
+      case 'j': nthreads = atoi(optarg); break;
+      case 'w': winlen   = strtoull(optarg, NULL, 0); break;
+      case 'o': csvfile  = optarg; break;
+      case 'H': histo    = 1; break;
+      case 'g': gen      = strtoull(optarg, NULL, 0); break;
+      case 'e': engine   = atoi(optarg) ? ENGINE_IIR : ENGINE_SPRING; break;
+      case 's': seed     = strtoul(optarg, NULL, 0); break;
+      case 'k': ckptfile = optarg; break;
+      case 'i': interval = atof(optarg); break;
+      default:  usage();
+    }
+  }
+  if(optind != argc - 1) usage();
+  if(nthreads < 1) nthreads = 1;
+  if(nthreads > MAXTHREADS) nthreads = MAXTHREADS;
+
+  // Generate trace
+  if(gen) {
+    if(generate(argv[optind], gen, engine, seed, ckptfile, interval)) {
+      fprintf(stderr, "Error: cannot write %s\n", argv[optind]);
+      return 1;
+    }
+    printf("Generated %llu frames (%s engine) to %s\n", (unsigned long long)gen,
+           engine ? "iir" : "spring", argv[optind]);
+    return 0;
+  }
+
+  // Map trace
+  if(trace_map(&trace, argv[optind])) {
+    fprintf(stderr, "Error: cannot map trace %s\n", argv[optind]);
+    return 1;
+  }
+  if(!trace.count) {
+    fprintf(stderr, "Error: trace %s is empty\n", argv[optind]);
+    return 1;
+  }
+  fps = trace.hdr->fps > 0 ? trace.hdr->fps : GENFPS;
+  if(!winlen) winlen = (uint64_t)(fps * 60 + 0.5);
+  quiet     = (uint64_t)(fps + 0.5);
+  nwindows  = (trace.count + winlen - 1) / winlen;
+  chunkwins = (CHUNKFRAMES + winlen - 1) / winlen;
+  nchunks   = (nwindows + chunkwins - 1) / chunkwins;
+  windows   = malloc(nwindows * sizeof(window_t));
+  results   = calloc(nthreads, sizeof(result_t));
+  if(!windows || !results) {
+    fprintf(stderr, "Error: out of memory\n");
+    return 1;
+  }
+
+  // Parallel reductions
+  for(i = 0; i < nthreads; i++) pthread_create(&threads[i], NULL, worker, &results[i]);
+  for(i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+  memset(&total, 0, sizeof(total));
+  for(i = 0; i < nthreads; i++) {
+    for(v = 0; v < 256; v++) {
+      total.hist[0][v] += results[i].hist[0][v];
+      total.hist[1][v] += results[i].hist[1][v];
+    }
+    total.gusts += results[i].gusts;
+  }
+
+  // Results
+  printf("Trace:   %s, %llu frames, %.1f fps, %.2f hours\n", argv[optind],
+         (unsigned long long)trace.count, fps, trace.count / fps / 3600);
+  printf("Windows: %llu of %llu frames (%.1f s)\n", (unsigned long long)nwindows,
+         (unsigned long long)winlen, winlen / fps);
+  printf("Gusts:   %llu (%.1f per hour)\n", (unsigned long long)total.gusts,
+         total.gusts / (trace.count / fps / 3600));
+  print_channel("OCR0A", 0, total.hist[0], trace.count, histo);
+  print_channel("OCR0B", 1, total.hist[1], trace.count, histo);
+  if(csvfile && write_csv(csvfile, fps)) {
+    fprintf(stderr, "Error: cannot write %s\n", csvfile);
+    return 1;
+  }
+  trace_unmap(&trace);
+  free(windows);
+  free(results);
+  return 0;
+}
@@ -0,0 +1,89 @@
+// ===================================================================================
+// Project:   TinyCandle - Value Change Dump Writer
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+
+#include <stdlib.h>
+#include <string.h>
+#include "vcd.h"
+
+// Output buffer size (large buffer keeps the number of write syscalls low)
+#define VCD_BUFSIZE   (1 << 20)
+
+// Signal identifier: single printable character starting with '!'
+#define VCD_ID(i)     ((char)('!' + (i)))
+
+// Write value of signal
+static void vcd_value(vcd_t *v, int i) {
+  uint32_t val = v->sig[i].value;
+  int      b;
+  if(v->sig[i].width == 1) {
+    fprintf(v->f, "%c%c\n", (val & 1) ? '1' : '0', VCD_ID(i));
+    return;
+  }
+  fputc('b', v->f);
+  for(b = v->sig[i].width - 1; b > 0 && !((val >> b) & 1); b--);
+  for(; b >= 0; b--) fputc(((val >> b) & 1) ? '1' : '0', v->f);
+  fprintf(v->f, " %c\n", VCD_ID(i));
+}
+
+// Open output file
+int vcd_open(vcd_t *v, const char *filename) {
+  memset(v, 0, sizeof(*v));
+  v->f = fopen(filename, "w");
+  if(!v->f) return -1;
+  setvbuf(v->f, NULL, _IOFBF, VCD_BUFSIZE);
+  return 0;
+}
+
+// Add signal, returns signal index
+int vcd_add(vcd_t *v, const char *name, uint8_t width) {
+  if(v->started || v->nsig >= VCD_MAXSIG) return -1;
+  strncpy(v->sig[v->nsig].name, name, sizeof(v->sig[0].name) - 1);
+  v->sig[v->nsig].width = width;
+  return v->nsig++;
+}
+
+// Write header and initial values
+void vcd_begin(vcd_t *v, const char *scope, const char *timescale) {
+  int i;
+  fprintf(v->f, "$version TinyCandle simulator $end\n");
+  fprintf(v->f, "$timescale %s $end\n", timescale);
+  fprintf(v->f, "$scope module %s $end\n", scope);
+  for(i = 0; i < v->nsig; i++)
+    fprintf(v->f, "$var wire %d %c %s $end\n", v->sig[i].width, VCD_ID(i), v->sig[i].name);
+  fprintf(v->f, "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n");
+  for(i = 0; i < v->nsig; i++) vcd_value(v, i);
+  fprintf(v->f, "$end\n");
+  v->started = 1;
+}
+
+// Set current timestamp, written lazily with the next value change
+void vcd_time(vcd_t *v, uint64_t time) {
+  v->time = time;
+}
+
+// Set signal value, written only if changed
+void vcd_set(vcd_t *v, int sig, uint32_t value) {
+  if(v->sig[sig].value == value) return;
+  v->sig[sig].value = value;
+  if(!v->started) return;
+  if(v->time != v->written) {
+    fprintf(v->f, "#%llu\n", (unsigned long long)v->time);
+    v->written = v->time;
+  }
+  vcd_value(v, sig);
+  v->changes++;
+}
+
+// Close file
+void vcd_close(vcd_t *v) {
+  if(!v->f) return;
+  if(v->time != v->written) fprintf(v->f, "#%llu\n", (unsigned long long)v->time);
+  fclose(v->f);
+  v->f = NULL;
+}
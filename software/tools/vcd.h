@@ -0,0 +1,50 @@
+// ===================================================================================
+// Project:   TinyCandle - Value Change Dump Writer
+// Version:   v1.0
+// Year:      2020
+// Author:    Stefan Wagner
+// Github:    https://github.com/wagiminator
+// License:   http://creativecommons.org/licenses/by-sa/3.0/
+// ===================================================================================
+//
+// Description:
+// ------------
+// Streams a Value Change Dump (IEEE 1364) to disk. Only changed values are written,
+// nothing but the last value of each signal is kept in memory, so the length of a
+// dump is limited by disk space only. The files can be viewed with GTKWave.
+
+#ifndef VCD_H
+#define VCD_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define VCD_MAXSIG    32
+
+typedef struct {
+  FILE     *f;
+  uint64_t  time;                 // current timestamp
+  uint64_t  written;              // last timestamp written to file
+  uint64_t  changes;              // number of value changes written
+  int       started;              // definitions done, dumping values
+  int       nsig;
+  struct {
+    char     name[24];
+    uint8_t  width;
+    uint32_t value;
+  } sig[VCD_MAXSIG];
+} vcd_t;
+
+// Open file, add signals, then start dumping with vcd_begin()
+int  vcd_open(vcd_t *v, const char *filename);
+int  vcd_add(vcd_t *v, const char *name, uint8_t width);
+void vcd_begin(vcd_t *v, const char *scope, const char *timescale);
+
+// Set timestamp (must not decrease) and signal values
+void vcd_time(vcd_t *v, uint64_t time);
+void vcd_set(vcd_t *v, int sig, uint32_t value);
+
+// Write final timestamp and close file
+void vcd_close(vcd_t *v);
+
+#endif